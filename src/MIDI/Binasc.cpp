@@ -11,6 +11,7 @@
 
 #include "Binasc.h"
 #include <sstream>
+#include <iterator>
 #include <string.h>
 #include <cstdlib>
 
@@ -254,14 +255,42 @@ int Binasc::writeToBinary(ostream& out, const string& infile) {
 
 
 int Binasc::writeToBinary(ostream& out, istream& input) {
-   char inputLine[1024] = {0};    // current line being processed
-   int  lineNum = 0;              // current line number
+   vector<uchar> binary;
+   int status = writeToBinary(binary, input);
+   out.write((const char*)binary.data(), binary.size());
+   return status;
+}
 
-   input.getline(inputLine, 1024, '\n');
-   lineNum++;
-   while (!input.eof()) {
-      processLine(out, inputLine, lineNum);
-      input.getline(inputLine, 1024, '\n');
+
+int Binasc::writeToBinary(vector<uchar>& out, istream& input) {
+   string text((istreambuf_iterator<char>(input)), istreambuf_iterator<char>());
+   return writeToBinary(out, text.data(), text.size());
+}
+
+
+
+//////////////////////////////
+//
+// Binasc::writeToBinary -- Memory version: append the bytes described by
+//     the ASCII text to the end of out.  The text is scanned once, line
+//     by line, without copying it into a stream.  A line containing an
+//     invalid word is reported and skipped after that word, as in the
+//     stream versions.
+//
+
+int Binasc::writeToBinary(vector<uchar>& out, const char* text, size_t size) {
+   const char* ptr = text;
+   const char* end = text + size;
+   int lineNum = 1;
+
+   // a typical binasc MIDI file has three characters per byte:
+   out.reserve(out.size() + size / 3);
+
+   while (ptr < end) {
+      const char* newline = (const char*)memchr(ptr, '\n', end - ptr);
+      const char* lineEnd = newline ? newline : end;
+      processLine(out, ptr, lineEnd, lineNum);
+      ptr = lineEnd + 1;
       lineNum++;
    }
    return 1;
@@ -495,24 +524,44 @@ int Binasc::outputStyleBoth(ostream& out, istream& input) {
 // processLine -- read a line of input and output any specified bytes
 //
 
-int Binasc::processLine(ostream& out, char* inputLine, int lineCount) {
-   const char* WORD_SEPARATORS = " \n\t";
-   char* word = strtok(inputLine, WORD_SEPARATORS);
+int Binasc::processLine(vector<uchar>& out, const char* line,
+      const char* end, int lineCount) {
+   char word[1024];
    int status = 1;
-   while (word != NULL) {
-      if ((word[0] == ';') || (word[0] == '#')) {
-         // comment to end of line.
+   while (line < end) {
+      // skip over word separators:
+      while ((line < end) && isWordSeparator(*line)) {
+         line++;
+      }
+      if (line >= end) {
+         break;
+      }
+      if ((*line == ';') || (*line == '#') || (*line == '\0')) {
+         // comment to end of line (a null character also ends the line,
+         // as it did when lines were read into C strings).
          return 1;
       }
+      const char* start = line;
+      while ((line < end) && !isWordSeparator(*line) && (*line != '\0')) {
+         line++;
+      }
+      int length = line - start;
+      if (length >= (int)sizeof(word)) {
+         cerr << "Error on line " << lineCount << ": word is too long" << endl;
+         return 0;
+      }
+      memcpy(word, start, length);
+      word[length] = '\0';
+
       if (word[0] == '+') {
          status = processAsciiWord(out, word, lineCount);
       } else if (word[0] == 'v') {
          status = processVlvWord(out, word, lineCount);
       } else if (word[0] == 'p') {
          status = processMidiPitchBendWord(out, word, lineCount);
-      } else if (strchr(word, '\'')) {
+      } else if (memchr(word, '\'', length)) {
          status = processDecimalWord(out, word, lineCount);
-      } else if (strchr(word, ',') || strlen(word) > 2) {
+      } else if (memchr(word, ',', length) || length > 2) {
          status = processBinaryWord(out, word, lineCount);
       } else {
          status = processHexWord(out, word, lineCount);
@@ -520,13 +569,25 @@ int Binasc::processLine(ostream& out, char* inputLine, int lineCount) {
       if (status == 0) {
          return 0;
       }
-      word = strtok(NULL, WORD_SEPARATORS);
    }
    return 1;
 }
 
 
 
+//////////////////////////////
+//
+// Binasc::isWordSeparator -- true for characters between words.  A
+//     carriage return is included so that text with DOS line endings
+//     does not leave it attached to the last word of each line.
+//
+
+int Binasc::isWordSeparator(char ch) {
+   return (ch == ' ') || (ch == '\t') || (ch == '\n') || (ch == '\r');
+}
+
+
+
 ///////////////////////////////
 //
 // Binasc::getVLV -- read a Variable-Length Value from the file
@@ -875,7 +936,7 @@ int Binasc::outputStyleMidi(ostream& out, istream& input) {
 //     constituent bytes
 //
 
-int Binasc::processDecimalWord(ostream& out, const char* word,
+int Binasc::processDecimalWord(vector<uchar>& out, const char* word,
       int lineNum) {
    int length = strlen(word);       // length of ascii binary number
    int byteCount = -1;              // number of bytes to output
@@ -1011,20 +1072,24 @@ int Binasc::processDecimalWord(ostream& out, const char* word,
    if (periodIndex != -1) {
       double doubleOutput = atof(&word[quoteIndex+1]);
       float  floatOutput  = (float)doubleOutput;
+      unsigned int floatBits;
+      unsigned long long doubleBits;
+      memcpy(&floatBits, &floatOutput, sizeof(floatBits));
+      memcpy(&doubleBits, &doubleOutput, sizeof(doubleBits));
       switch (byteCount) {
          case 4:
            if (endianIndex == -1) {
-              writeBigEndianFloat(out, floatOutput);
+              appendBigEndian(out, floatBits, 4);
            } else {
-              writeLittleEndianFloat(out, floatOutput);
+              appendLittleEndian(out, floatBits, 4);
            }
            return 1;
            break;
          case 8:
            if (endianIndex == -1) {
-              writeBigEndianDouble(out, doubleOutput);
+              appendBigEndian(out, doubleBits, 8);
            } else {
-              writeLittleEndianDouble(out, doubleOutput);
+              appendLittleEndian(out, doubleBits, 8);
            }
            return 1;
            break;
@@ -1051,7 +1116,7 @@ int Binasc::processDecimalWord(ostream& out, const char* word,
             return 0;
          }
          char charOutput = (char)tempLong;
-         out << charOutput;
+         out.push_back(charOutput);
          return 1;
       } else {
          ulong tempLong = (ulong)atoi(&word[quoteIndex + 1]);
@@ -1062,7 +1127,7 @@ int Binasc::processDecimalWord(ostream& out, const char* word,
             cerr << "Decimal number out of range from 0 to 255" << endl;
             return 0;
          }
-         out << ucharOutput;
+         out.push_back(ucharOutput);
          return 1;
       }
    }
@@ -1073,12 +1138,12 @@ int Binasc::processDecimalWord(ostream& out, const char* word,
          if (signIndex != -1) {
             long tempLong = atoi(&word[quoteIndex + 1]);
             char charOutput = (char)tempLong;
-            out << charOutput;
+            out.push_back(charOutput);
             return 1;
          } else {
             ulong tempLong = (ulong)atoi(&word[quoteIndex + 1]);
             uchar ucharOutput = (uchar)tempLong;
-            out << ucharOutput;
+            out.push_back(ucharOutput);
             return 1;
          }
          break;
@@ -1087,18 +1152,18 @@ int Binasc::processDecimalWord(ostream& out, const char* word,
             long tempLong = atoi(&word[quoteIndex + 1]);
             short shortOutput = (short)tempLong;
             if (endianIndex == -1) {
-               writeBigEndianShort(out, shortOutput);
+               appendBigEndian(out, shortOutput, 2);
             } else {
-               writeLittleEndianShort(out, shortOutput);
+               appendLittleEndian(out, shortOutput, 2);
             }
             return 1;
          } else {
             ulong tempLong = (ulong)atoi(&word[quoteIndex + 1]);
             ushort ushortOutput = (ushort)tempLong;
             if (endianIndex == -1) {
-               writeBigEndianUShort(out, ushortOutput);
+               appendBigEndian(out, ushortOutput, 2);
             } else {
-               writeLittleEndianUShort(out, ushortOutput);
+               appendLittleEndian(out, ushortOutput, 2);
             }
             return 1;
          }
@@ -1117,13 +1182,13 @@ int Binasc::processDecimalWord(ostream& out, const char* word,
          uchar byte2 = (tempLong & 0x0000ff00) >>  8;
          uchar byte3 = (tempLong & 0x000000ff);
          if (endianIndex == -1) {
-            out << byte1;
-            out << byte2;
-            out << byte3;
+            out.push_back(byte1);
+            out.push_back(byte2);
+            out.push_back(byte3);
          } else {
-            out << byte3;
-            out << byte2;
-            out << byte1;
+            out.push_back(byte3);
+            out.push_back(byte2);
+            out.push_back(byte1);
          }
          return 1;
          }
@@ -1132,17 +1197,17 @@ int Binasc::processDecimalWord(ostream& out, const char* word,
          if (signIndex != -1) {
             long tempLong = atoi(&word[quoteIndex + 1]);
             if (endianIndex == -1) {
-               writeBigEndianLong(out, tempLong);
+               appendBigEndian(out, tempLong, 4);
             } else {
-               writeLittleEndianLong(out, tempLong);
+               appendLittleEndian(out, tempLong, 4);
             }
             return 1;
          } else {
             ulong tempuLong = (ulong)atoi(&word[quoteIndex + 1]);
             if (endianIndex == -1) {
-               writeBigEndianULong(out, tempuLong);
+               appendBigEndian(out, tempuLong, 4);
             } else {
-               writeLittleEndianULong(out, tempuLong);
+               appendLittleEndian(out, tempuLong, 4);
             }
             return 1;
          }
@@ -1165,7 +1230,7 @@ int Binasc::processDecimalWord(ostream& out, const char* word,
 //     its binary byte form.
 //
 
-int Binasc::processHexWord(ostream& out, const char* word, int lineNum) {
+int Binasc::processHexWord(vector<uchar>& out, const char* word, int lineNum) {
    int length = strlen(word);
    uchar outputByte;
 
@@ -1182,7 +1247,7 @@ int Binasc::processHexWord(ostream& out, const char* word, int lineNum) {
    }
 
    outputByte = (uchar)strtol(word, (char**)NULL, 16);
-   out << outputByte;
+   out.push_back(outputByte);
    return 1;
 }
 
@@ -1194,7 +1259,7 @@ int Binasc::processHexWord(ostream& out, const char* word, int lineNum) {
 //     its constituent byte
 //
 
-int Binasc::processAsciiWord(ostream& out, const char* word, int lineNum) {
+int Binasc::processAsciiWord(vector<uchar>& out, const char* word, int lineNum) {
    int length = strlen(word);
    uchar outputByte;
 
@@ -1216,7 +1281,7 @@ int Binasc::processAsciiWord(ostream& out, const char* word, int lineNum) {
    } else {
       outputByte = ' ';
    }
-   out << outputByte;
+   out.push_back(outputByte);
    return 1;
 }
 
@@ -1228,7 +1293,7 @@ int Binasc::processAsciiWord(ostream& out, const char* word, int lineNum) {
 //     its constituent byte
 //
 
-int Binasc::processBinaryWord(ostream& out, const char* word,
+int Binasc::processBinaryWord(vector<uchar>& out, const char* word,
       int lineNum) {
    int length = strlen(word);       // length of ascii binary number
    int commaIndex = -1;             // index location of comma in number
@@ -1319,7 +1384,7 @@ int Binasc::processBinaryWord(ostream& out, const char* word,
    }
 
    // send the byte to the output
-   out << output;
+   out.push_back(output);
    return 1;
 }
 
@@ -1336,7 +1401,7 @@ int Binasc::processBinaryWord(ostream& out, const char* word,
 //   without space by an integer.
 //
 
-int Binasc::processVlvWord(ostream& out, const char* word, int lineNum) {
+int Binasc::processVlvWord(vector<uchar>& out, const char* word, int lineNum) {
    if (strlen(word) < 2) {
       cerr << "Error on line: " << lineNum
            << ": 'v' needs to be followed immediately by a decimal digit"
@@ -1371,7 +1436,7 @@ int Binasc::processVlvWord(ostream& out, const char* word, int lineNum) {
 
    for (i=0; i<5; i++) {
       if (byte[i] >= 0x80 || i == 4) {
-         out << byte[i];
+         out.push_back(byte[i]);
       }
    }
 
@@ -1389,7 +1454,7 @@ int Binasc::processVlvWord(ostream& out, const char* word, int lineNum) {
 //   7-bits of the 14-bit value, then the MSB coming second and containing
 //   the top 7-bits of the 14-bit value.
 
-int Binasc::processMidiPitchBendWord(ostream& out, const char* word,
+int Binasc::processMidiPitchBendWord(vector<uchar>& out, const char* word,
       int lineNum) {
    if (strlen(word) < 2) {
       cerr << "Error on line: " << lineNum
@@ -1416,12 +1481,43 @@ int Binasc::processMidiPitchBendWord(ostream& out, const char* word,
    int intval = (int)(((1 << 13)-0.5)  * (value + 1.0) + 0.5);
    uchar LSB = intval & 0x7f;
    uchar MSB = (intval >>  7) & 0x7f;
-   out << LSB << MSB;
+   out.push_back(LSB);
+   out.push_back(MSB);
    return 1;
 }
 
 
 
+//////////////////////////////
+//
+// Binasc::appendBigEndian -- append the lowest count bytes of value,
+//     most significant byte first.
+//
+
+void Binasc::appendBigEndian(vector<uchar>& out, unsigned long long value,
+      int count) {
+   for (int i=count-1; i>=0; i--) {
+      out.push_back((uchar)((value >> (8 * i)) & 0xff));
+   }
+}
+
+
+
+//////////////////////////////
+//
+// Binasc::appendLittleEndian -- append the lowest count bytes of value,
+//     least significant byte first.
+//
+
+void Binasc::appendLittleEndian(vector<uchar>& out, unsigned long long value,
+      int count) {
+   for (int i=0; i<count; i++) {
+      out.push_back((uchar)((value >> (8 * i)) & 0xff));
+   }
+}
+
+
+
 ///////////////////////////////////////////////////////////////////////////
 //
 // Ordered byte writing functions --
@@ -14,6 +14,8 @@
 
 #include <iostream>
 #include <fstream>
+#include <string>
+#include <vector>
 
 using namespace std;
 
@@ -49,6 +51,9 @@ class Binasc {
       int      writeToBinary  (const string& outfile, istream& input);
       int      writeToBinary  (ostream& out, const string& infile);
       int      writeToBinary  (ostream& out, istream& input);
+      int      writeToBinary  (vector<uchar>& out, istream& input);
+      int      writeToBinary  (vector<uchar>& out, const char* text,
+                               size_t size);
 
       // functions for converting into an ASCII file with hex bytes:
       int      readFromBinary (const string& outfile, const string& infile);
@@ -72,14 +77,25 @@ class Binasc {
 
    protected:
       // helper functions for reading ASCII content to conver to binary:
-      int      processLine        (ostream& out, char* word, int lineNum);
-      int      processAsciiWord   (ostream& out, const char* word, int lineNum);
-      int      processBinaryWord  (ostream& out, const char* word, int lineNum);
-      int      processDecimalWord (ostream& out, const char* word, int lineNum);
-      int      processHexWord     (ostream& out, const char* word, int lineNum);
-      int      processVlvWord     (ostream& out, const char* word, int lineNum);
-      int      processMidiPitchBendWord(ostream& out, const char* word, 
+      int      processLine        (vector<uchar>& out, const char* line,
+                                   const char* end, int lineNum);
+      int      processAsciiWord   (vector<uchar>& out, const char* word,
                                    int lineNum);
+      int      processBinaryWord  (vector<uchar>& out, const char* word,
+                                   int lineNum);
+      int      processDecimalWord (vector<uchar>& out, const char* word,
+                                   int lineNum);
+      int      processHexWord     (vector<uchar>& out, const char* word,
+                                   int lineNum);
+      int      processVlvWord     (vector<uchar>& out, const char* word,
+                                   int lineNum);
+      int      processMidiPitchBendWord(vector<uchar>& out, const char* word,
+                                   int lineNum);
+      static int  isWordSeparator    (char ch);
+      static void appendBigEndian    (vector<uchar>& out,
+                                      unsigned long long value, int count);
+      static void appendLittleEndian (vector<uchar>& out,
+                                      unsigned long long value, int count);
 
       // helper functions for reading binary content to convert to ASCII:
       int      outputStyleAscii   (ostream& out, istream& input);
@@ -0,0 +1,371 @@
+//
+// Filename:      midifile/src-library/CompactMidiEvent.cpp
+// Syntax:        C++11
+// vim:           ts=3 expandtab
+//
+// Description:   Fixed-size (24 byte) representation of a MidiEvent for
+//                dense scans over a file.
+//
+
+#include "CompactMidiEvent.h"
+#include "MidiFile.h"
+
+#include <algorithm>
+#include <string.h>
+#include <type_traits>
+
+using namespace std;
+
+static_assert(sizeof(CompactMidiEvent) == 24,
+      "CompactMidiEvent is expected to occupy 24 bytes");
+static_assert(is_trivial<CompactMidiEvent>::value,
+      "CompactMidiEvent must remain a POD type");
+
+
+//////////////////////////////
+//
+// CompactMidiEvent::getSortKey -- Return the same sort key as
+//    eventsortkey() does for the MidiEvent: the tick, then note-offs
+//    and other messages before note-ons, before meta messages, before
+//    the end of track.
+//
+
+long long CompactMidiEvent::getSortKey(void) const {
+   int rank;
+   if (size == 0) {
+      rank = 0;
+   } else if (bytes[0] == 0xff) {
+      rank = ((size != 1) && (bytes[1] == 0x2f)) ? 3 : 2;
+   } else if ((bytes[0] & 0xf0) == 0x90) {
+      rank = 1;
+   } else {
+      rank = 0;
+   }
+   return (long long)tick * 4 + rank;
+}
+
+
+
+//////////////////////////////
+//
+// CompactMidiEventList::CompactMidiEventList -- Constructor.
+//
+
+CompactMidiEventList::CompactMidiEventList(void) {
+   // do nothing
+}
+
+
+
+//////////////////////////////
+//
+// CompactMidiEventList::~CompactMidiEventList -- Deconstructor.
+//
+
+CompactMidiEventList::~CompactMidiEventList() {
+   clear();
+}
+
+
+
+//////////////////////////////
+//
+// CompactMidiEventList::operator[] --
+//
+
+CompactMidiEvent& CompactMidiEventList::operator[](int index) {
+   return events[index];
+}
+
+
+
+//////////////////////////////
+//
+// CompactMidiEventList::data -- Return the dense event array.
+//
+
+CompactMidiEvent* CompactMidiEventList::data(void) {
+   return events.data();
+}
+
+
+
+//////////////////////////////
+//
+// CompactMidiEventList::getSize -- Return the number of events.
+//
+
+int CompactMidiEventList::getSize(void) {
+   return events.size();
+}
+
+
+int CompactMidiEventList::size(void) {
+   return getSize();
+}
+
+
+
+//////////////////////////////
+//
+// CompactMidiEventList::clear -- Remove all events and side data.
+//
+
+void CompactMidiEventList::clear(void) {
+   events.clear();
+   sidebuffer.clear();
+}
+
+
+
+//////////////////////////////
+//
+// CompactMidiEventList::reserve -- Pre-allocate space for events.
+//
+
+void CompactMidiEventList::reserve(int rsize) {
+   if (rsize > (int)events.size()) {
+      events.reserve(rsize);
+   }
+}
+
+
+
+//////////////////////////////
+//
+// CompactMidiEventList::append -- Add a compact copy of a MidiEvent
+//    (or of all events in a track or file) at the end of the list.
+//    Returns the index of the appended event.  Note links are not
+//    stored; use linkNotePairs() on the compact list instead.  Events
+//    from a MidiFile are appended track by track: call sortByTick()
+//    afterwards to obtain a time-ordered list.
+//
+
+int CompactMidiEventList::append(MidiEvent& event) {
+   CompactMidiEvent cevent;
+   cevent.seconds  = event.seconds;
+   cevent.tick     = event.tick;
+   cevent.track    = (ushort)event.track;
+   cevent.bytes[0] = 0;
+   cevent.bytes[1] = 0;
+   cevent.bytes[2] = 0;
+   cevent.offset   = -1;
+
+   int length = event.size();
+   int inlinecount = length < 3 ? length : 3;
+   for (int i=0; i<inlinecount; i++) {
+      cevent.bytes[i] = event[i];
+   }
+
+   if (length <= 3) {
+      cevent.size = (uchar)length;
+   } else {
+      cevent.size = 0xff;
+      cevent.offset = sidebuffer.size();
+      sidebuffer.resize(sidebuffer.size() + 4 + length);
+      uchar* ptr = sidebuffer.data() + cevent.offset;
+      ptr[0] = (uchar)(length & 0xff);
+      ptr[1] = (uchar)((length >> 8) & 0xff);
+      ptr[2] = (uchar)((length >> 16) & 0xff);
+      ptr[3] = (uchar)((length >> 24) & 0xff);
+      memcpy(ptr + 4, event.data(), length);
+   }
+
+   events.push_back(cevent);
+   return events.size() - 1;
+}
+
+
+void CompactMidiEventList::append(MidiEventList& list) {
+   reserve(size() + list.size());
+   for (int i=0; i<list.size(); i++) {
+      append(list[i]);
+   }
+}
+
+
+void CompactMidiEventList::append(MidiFile& midifile) {
+   int total = size();
+   for (int i=0; i<midifile.getTrackCount(); i++) {
+      total += midifile[i].size();
+   }
+   reserve(total);
+   for (int i=0; i<midifile.getTrackCount(); i++) {
+      append(midifile[i]);
+   }
+}
+
+
+
+//////////////////////////////
+//
+// CompactMidiEventList::getEvent -- Expand a compact event back into a
+//    MidiEvent (without any note link).
+//
+
+void CompactMidiEventList::getEvent(int index, MidiEvent& event) {
+   int length = getMessageSize(index);
+   const uchar* message = getMessage(index);
+   event.unlinkEvent();
+   event.resize(length);
+   for (int i=0; i<length; i++) {
+      event[i] = message[i];
+   }
+   event.tick    = events[index].tick;
+   event.track   = events[index].track;
+   event.seconds = events[index].seconds;
+}
+
+
+
+//////////////////////////////
+//
+// CompactMidiEventList::getMessageSize -- Return the number of bytes in
+//    the MIDI message of the given event.
+//
+
+int CompactMidiEventList::getMessageSize(int index) {
+   CompactMidiEvent& cevent = events[index];
+   if (!cevent.isLong()) {
+      return cevent.size;
+   }
+   const uchar* ptr = sidebuffer.data() + cevent.offset;
+   return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | (ptr[3] << 24);
+}
+
+
+
+//////////////////////////////
+//
+// CompactMidiEventList::getMessage -- Return a pointer to the bytes of
+//    the MIDI message of the given event.  The pointer is invalidated
+//    when further events are appended.
+//
+
+const uchar* CompactMidiEventList::getMessage(int index) {
+   CompactMidiEvent& cevent = events[index];
+   if (!cevent.isLong()) {
+      return cevent.bytes;
+   }
+   return sidebuffer.data() + cevent.offset + 4;
+}
+
+
+
+//////////////////////////////
+//
+// CompactMidiEventList::getTempoMicro -- Return the microseconds per
+//    quarter note of a tempo meta message, or -1 for other messages.
+//
+
+int CompactMidiEventList::getTempoMicro(int index) {
+   if (!events[index].isTempo() || (getMessageSize(index) < 6)) {
+      return -1;
+   }
+   const uchar* message = getMessage(index);
+   return (message[3] << 16) + (message[4] << 8) + message[5];
+}
+
+
+
+//////////////////////////////
+//
+// CompactMidiEventList::sortByTick -- Stable sort of the events by the
+//    sort key of MidiFile::joinTracks() (see CompactMidiEvent::getSortKey),
+//    so that events at the same tick are in the same order as in a
+//    joined MidiFile, and then keep their track and file order.
+//
+
+void CompactMidiEventList::sortByTick(void) {
+   stable_sort(events.begin(), events.end(),
+      [](const CompactMidiEvent& a, const CompactMidiEvent& b) {
+         return a.getSortKey() < b.getSortKey();
+      });
+}
+
+
+
+//////////////////////////////
+//
+// CompactMidiEventList::doTimeAnalysis -- Fill in the time in seconds of
+//    each event, following tempo changes as MidiFile::doTimeAnalysis
+//    does.  Each time is measured from the start of its tempo segment,
+//    as in the time map of MidiFile, so that rounding errors do not add
+//    up over long files.  The list must be in absolute ticks and sorted
+//    by tick.
+//
+
+void CompactMidiEventList::doTimeAnalysis(int tpq) {
+   double secondsPerTick = 60.0 / (120.0 * tpq);
+   double segmentsec = 0.0;
+   int segmenttick = 0;
+   int count = size();
+   for (int i=0; i<count; i++) {
+      CompactMidiEvent& cevent = events[i];
+      cevent.seconds = segmentsec +
+            (cevent.tick - segmenttick) * secondsPerTick;
+      if (cevent.isTempo()) {
+         int micro = getTempoMicro(i);
+         if (micro > 0) {
+            segmentsec = cevent.seconds;
+            segmenttick = cevent.tick;
+            secondsPerTick = (double)micro / 1000000.0 / tpq;
+         }
+      }
+   }
+}
+
+
+
+//////////////////////////////
+//
+// CompactMidiEventList::linkNotePairs -- Match note-ons to note-offs within
+//    each track, using the same rule as MidiEventList::linkNotePairs (the
+//    first note-off ends the last note-on of the same channel and key).
+//    links[i] is set to the index of the matching event, or -1.  Returns
+//    the number of linked pairs.
+//
+
+int CompactMidiEventList::linkNotePairs(vector<int>& links) {
+   int count = size();
+   links.assign(count, -1);
+
+   int maxtrack = 0;
+   for (int i=0; i<count; i++) {
+      if (events[i].track > maxtrack) {
+         maxtrack = events[i].track;
+      }
+   }
+
+   // Intrusive stacks of active note-ons for each (track, channel, key):
+   // top[] holds the most recent unmatched note-on, and below[] the
+   // note-on which was active before it.
+   vector<int> top((maxtrack + 1) * 16 * 128, -1);
+   vector<int> below(count, -1);
+
+   int pairs = 0;
+   for (int i=0; i<count; i++) {
+      CompactMidiEvent& cevent = events[i];
+      int on  = cevent.isNoteOn();
+      int off = !on && cevent.isNoteOff();
+      if (!on && !off) {
+         continue;
+      }
+      int slot = (cevent.track * 16 + cevent.getChannel()) * 128 +
+            (cevent.getKeyNumber() & 0x7f);
+      if (on) {
+         below[i] = top[slot];
+         top[slot] = i;
+      } else if (top[slot] >= 0) {
+         int noteon = top[slot];
+         top[slot] = below[noteon];
+         links[noteon] = i;
+         links[i] = noteon;
+         pairs++;
+      }
+   }
+   return pairs;
+}
+
+
+
@@ -0,0 +1,88 @@
+//
+// Filename:      midifile/include/CompactMidiEvent.h
+// Syntax:        C++11
+// vim:           ts=3 expandtab
+//
+// Description:   Fixed-size (24 byte) representation of a MidiEvent for
+//                dense scans over a file.  Messages of up to three bytes
+//                are stored inline; longer meta and sysex messages are
+//                stored in a side buffer of the CompactMidiEventList.
+//
+
+#ifndef _COMPACTMIDIEVENT_H_INCLUDED
+#define _COMPACTMIDIEVENT_H_INCLUDED
+
+#include "MidiEvent.h"
+#include "MidiEventList.h"
+#include <vector>
+
+using namespace std;
+
+class MidiFile;
+
+class CompactMidiEvent {
+   public:
+      double    seconds;
+      int       tick;
+      ushort    track;
+      uchar     size;        // message size if <= 3, else 0xff
+      uchar     bytes[3];    // first three bytes of the message
+      int       offset;      // side buffer offset of long messages, else -1
+
+      int       isLong         (void) const { return size == 0xff; }
+      int       getCommandByte (void) const { return bytes[0]; }
+      int       getChannel     (void) const { return bytes[0] & 0x0f; }
+      int       getKeyNumber   (void) const { return bytes[1]; }
+      int       getVelocity    (void) const { return bytes[2]; }
+      int       isMeta         (void) const { return bytes[0] == 0xff; }
+      int       isTempo        (void) const { return (bytes[0] == 0xff) &&
+                                                     (bytes[1] == 0x51); }
+      int       isEndOfTrack   (void) const { return (bytes[0] == 0xff) &&
+                                                     (bytes[1] == 0x2f); }
+      int       isNoteOn       (void) const { return (size == 3) &&
+                                  ((bytes[0] & 0xf0) == 0x90) &&
+                                  (bytes[2] != 0); }
+      int       isNoteOff      (void) const { return (size == 3) &&
+                                  (((bytes[0] & 0xf0) == 0x80) ||
+                                  (((bytes[0] & 0xf0) == 0x90) &&
+                                   (bytes[2] == 0))); }
+      long long getSortKey     (void) const;
+};
+
+
+class CompactMidiEventList {
+   public:
+                  CompactMidiEventList  (void);
+                 ~CompactMidiEventList  ();
+
+      CompactMidiEvent& operator[]      (int index);
+      CompactMidiEvent* data            (void);
+      int         size                  (void);
+      int         getSize               (void);
+      void        clear                 (void);
+      void        reserve               (int rsize);
+
+      // conversion to and from MidiEvents:
+      int         append                (MidiEvent& event);
+      void        append                (MidiEventList& list);
+      void        append                (MidiFile& midifile);
+      void        getEvent              (int index, MidiEvent& event);
+      int         getMessageSize        (int index);
+      const uchar* getMessage           (int index);
+
+      // analysis over the dense array:
+      void        sortByTick            (void);
+      void        doTimeAnalysis        (int tpq);
+      int         linkNotePairs         (vector<int>& links);
+      int         getTempoMicro         (int index);
+
+   private:
+      vector<CompactMidiEvent>  events;
+      vector<uchar>             sidebuffer;  // 4-byte length, then bytes
+};
+
+
+#endif /* _COMPACTMIDIEVENT_H_INCLUDED */
+
+
+
@@ -0,0 +1,244 @@
+//
+// Filename:      midifile/src-library/MappedFile.cpp
+// Syntax:        C++11
+// vim:           ts=3 expandtab
+//
+// Description:   Read-only view of a file's bytes.  The file is memory
+//                mapped where the platform allows it, otherwise it is
+//                read into a private buffer.
+//
+
+#include "MappedFile.h"
+
+#include <fstream>
+
+#ifdef _WIN32
+   #include <windows.h>
+#else
+   #include <sys/mman.h>
+   #include <sys/stat.h>
+   #include <fcntl.h>
+   #include <unistd.h>
+#endif
+
+using namespace std;
+
+
+//////////////////////////////
+//
+// MappedFile::MappedFile -- Constructor.
+//
+
+MappedFile::MappedFile(void) {
+   bytes   = NULL;
+   length  = 0;
+   openQ   = 0;
+   mappedQ = 0;
+#ifdef _WIN32
+   fileHandle = NULL;
+   mapHandle  = NULL;
+#endif
+}
+
+
+MappedFile::MappedFile(const char* filename) {
+   bytes   = NULL;
+   length  = 0;
+   openQ   = 0;
+   mappedQ = 0;
+#ifdef _WIN32
+   fileHandle = NULL;
+   mapHandle  = NULL;
+#endif
+   open(filename);
+}
+
+
+MappedFile::MappedFile(const string& filename) {
+   bytes   = NULL;
+   length  = 0;
+   openQ   = 0;
+   mappedQ = 0;
+#ifdef _WIN32
+   fileHandle = NULL;
+   mapHandle  = NULL;
+#endif
+   open(filename.c_str());
+}
+
+
+
+//////////////////////////////
+//
+// MappedFile::~MappedFile -- Deconstructor.  Release the mapping.
+//
+
+MappedFile::~MappedFile() {
+   close();
+}
+
+
+
+//////////////////////////////
+//
+// MappedFile::open -- Attach to the given file.  The file is mapped
+//    into memory if possible; if the mapping fails (or the file is
+//    empty) the contents are read into an internal buffer instead.
+//    Returns 1 on success, 0 if the file could not be opened.
+//
+
+int MappedFile::open(const char* filename) {
+   close();
+   if (filename == NULL) {
+      return 0;
+   }
+
+#ifdef _WIN32
+   HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+         OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+         NULL);
+   if (file != INVALID_HANDLE_VALUE) {
+      LARGE_INTEGER filesize;
+      if (GetFileSizeEx(file, &filesize) && filesize.QuadPart > 0) {
+         HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY,
+               0, 0, NULL);
+         if (mapping != NULL) {
+            void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            if (view != NULL) {
+               fileHandle = file;
+               mapHandle  = mapping;
+               bytes      = (const uchar*)view;
+               length     = (size_t)filesize.QuadPart;
+               mappedQ    = 1;
+               openQ      = 1;
+               return 1;
+            }
+            CloseHandle(mapping);
+         }
+      }
+      CloseHandle(file);
+   }
+#else
+   int descriptor = ::open(filename, O_RDONLY);
+   if (descriptor >= 0) {
+      struct stat info;
+      if ((fstat(descriptor, &info) == 0) && (info.st_size > 0)) {
+         void* view = mmap(NULL, (size_t)info.st_size, PROT_READ,
+               MAP_PRIVATE, descriptor, 0);
+         if (view != MAP_FAILED) {
+            #ifdef MADV_SEQUENTIAL
+               madvise(view, (size_t)info.st_size, MADV_SEQUENTIAL);
+            #endif
+            // The mapping stays valid after the descriptor is closed.
+            ::close(descriptor);
+            bytes   = (const uchar*)view;
+            length  = (size_t)info.st_size;
+            mappedQ = 1;
+            openQ   = 1;
+            return 1;
+         }
+      }
+      ::close(descriptor);
+   }
+#endif
+
+   // Could not map the file, so fall back to reading it all at once.
+   fstream input(filename, ios::binary | ios::in);
+   if (!input.is_open()) {
+      return 0;
+   }
+   input.seekg(0, ios::end);
+   streamoff filesize = input.tellg();
+   input.seekg(0, ios::beg);
+   if (filesize < 0) {
+      return 0;
+   }
+   buffer.resize((size_t)filesize);
+   if (filesize > 0) {
+      input.read((char*)buffer.data(), filesize);
+   }
+   bytes   = buffer.data();
+   length  = buffer.size();
+   mappedQ = 0;
+   openQ   = 1;
+   return 1;
+}
+
+
+int MappedFile::open(const string& filename) {
+   return open(filename.c_str());
+}
+
+
+
+//////////////////////////////
+//
+// MappedFile::close -- Release the file contents.
+//
+
+void MappedFile::close(void) {
+   if (mappedQ) {
+#ifdef _WIN32
+      UnmapViewOfFile((LPCVOID)bytes);
+      CloseHandle((HANDLE)mapHandle);
+      CloseHandle((HANDLE)fileHandle);
+      mapHandle  = NULL;
+      fileHandle = NULL;
+#else
+      munmap((void*)bytes, length);
+#endif
+   }
+   buffer.clear();
+   bytes   = NULL;
+   length  = 0;
+   openQ   = 0;
+   mappedQ = 0;
+}
+
+
+
+//////////////////////////////
+//
+// MappedFile::isOpen -- Returns true if a file is attached.
+//
+
+int MappedFile::isOpen(void) {
+   return openQ;
+}
+
+
+
+//////////////////////////////
+//
+// MappedFile::isMapped -- Returns true if the contents are memory mapped
+//    rather than copied into a private buffer.
+//
+
+int MappedFile::isMapped(void) {
+   return mappedQ;
+}
+
+
+
+//////////////////////////////
+//
+// MappedFile::data -- Return a pointer to the first byte of the file.
+//
+
+const uchar* MappedFile::data(void) {
+   return bytes;
+}
+
+
+
+//////////////////////////////
+//
+// MappedFile::size -- Return the number of bytes in the file.
+//
+
+size_t MappedFile::size(void) {
+   return length;
+}
+
+
+
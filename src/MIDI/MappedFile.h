@@ -0,0 +1,60 @@
+//
+// Filename:      midifile/include/MappedFile.h
+// Syntax:        C++11
+// vim:           ts=3 expandtab
+//
+// Description:   Read-only view of a file's bytes.  The file is memory
+//                mapped where the platform allows it, otherwise it is
+//                read into a private buffer, so that parsers can work
+//                directly on a byte span rather than through an istream.
+//
+
+#ifndef _MAPPEDFILE_H_INCLUDED
+#define _MAPPEDFILE_H_INCLUDED
+
+#include <vector>
+#include <string>
+#include <cstddef>
+
+using namespace std;
+
+typedef unsigned char  uchar;
+
+class MappedFile {
+   public:
+                     MappedFile     (void);
+                     MappedFile     (const char* filename);
+                     MappedFile     (const string& filename);
+                    ~MappedFile     ();
+
+      int            open           (const char* filename);
+      int            open           (const string& filename);
+      void           close          (void);
+      int            isOpen         (void);
+      int            isMapped       (void);
+
+      const uchar*   data           (void);
+      size_t         size           (void);
+
+   private:
+      const uchar*   bytes;         // start of the file contents
+      size_t         length;        // number of bytes in the file
+      int            openQ;         // true if a file is attached
+      int            mappedQ;       // true if bytes points to a mapping
+      vector<uchar>  buffer;        // storage when mapping is not possible
+
+#ifdef _WIN32
+      void*          fileHandle;
+      void*          mapHandle;
+#endif
+
+      // disallow copying, since the mapping is owned by the object:
+                     MappedFile     (const MappedFile& other);
+      MappedFile&    operator=      (const MappedFile& other);
+};
+
+
+#endif /* _MAPPEDFILE_H_INCLUDED */
+
+
+
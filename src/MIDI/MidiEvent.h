@@ -61,6 +61,10 @@ class MidiEvent : public MidiMessage {
    private:
       MidiEvent* eventlink;      // used to match note-ons and note-offs
 
+   // MidiEventList::linkNotePairs() threads its stacks of active note-ons
+   // through eventlink:
+   friend class MidiEventList;
+
 };
 
 
@@ -12,6 +12,7 @@
 
 
 #include "MidiEventList.h"
+#include "NoteTable.h"
 
 #include <vector>
 #include <iostream>
@@ -25,6 +26,7 @@ using namespace std;
 //
 
 MidiEventList::MidiEventList(void) {
+   pool = NULL;
    reserve(1000);
 }
 
@@ -85,10 +87,15 @@ MidiEvent& MidiEventList::getEvent(int index) {
 //////////////////////////////
 //
 // MidiEventList::clear -- De-allocate any MidiEvents present in the list
-//    and set the size of the list to 0.
+//    and set the size of the list to 0.  Events stored in a pool are
+//    released when the pool itself is cleared.
 //
 
 void MidiEventList::clear(void) {
+   if (pool != NULL) {
+      list.resize(0);
+      return;
+   }
    for (int i=0; i<list.size(); i++) {
       if (list[i] != NULL) {
          delete list[i];
@@ -111,6 +118,32 @@ MidiEvent** MidiEventList::data(void) {
 
 
 
+//////////////////////////////
+//
+// MidiEventList::setPool -- Allocate appended events from the given pool
+//    rather than individually on the heap.  The pool must outlive the
+//    events in the list.  Set to NULL to return to heap allocation
+//    (only for a list which does not contain pooled events).
+//
+
+void MidiEventList::setPool(MidiEventPool* apool) {
+   pool = apool;
+}
+
+
+
+//////////////////////////////
+//
+// MidiEventList::getPool -- Return the event pool, or NULL if events
+//    are allocated on the heap.
+//
+
+MidiEventPool* MidiEventList::getPool(void) {
+   return pool;
+}
+
+
+
 //////////////////////////////
 //
 // MidiEventList::reserve --  Pre-allocate space in the list for storing
@@ -147,7 +180,12 @@ int MidiEventList::size(void) {
 //
 
 int MidiEventList::append(MidiEvent& event) { 
-   MidiEvent* ptr = new MidiEvent(event);
+   MidiEvent* ptr;
+   if (pool != NULL) {
+      ptr = pool->allocate(event);
+   } else {
+      ptr = new MidiEvent(event);
+   }
    list.push_back(ptr);
    return list.size()-1;
 }
@@ -163,6 +201,30 @@ int MidiEventList::push_back(MidiEvent& event) {
 }
 
 
+//////////////////////////////
+//
+// MidiEventList::remove -- Remove the event at the given index from the
+//    list, unlinking it from any note pair.  Events stored in a pool
+//    are released when the pool itself is cleared.
+//
+
+void MidiEventList::remove(int index) {
+   if ((index < 0) || (index >= (int)list.size())) {
+      return;
+   }
+   MidiEvent* ptr = list[index];
+   list.erase(list.begin() + index);
+   if (ptr == NULL) {
+      return;
+   }
+   ptr->unlinkEvent();
+   if (pool == NULL) {
+      delete ptr;
+   }
+}
+
+
+
 //////////////////////////////
 //
 // MidiEventList::linkNotePairs -- Match note-ones and note-offs together
@@ -172,47 +234,18 @@ int MidiEventList::push_back(MidiEvent& event) {
 //   first note-off affects the last note-on, but both methods could
 //   be implemented with user selectability.  The current state of the
 //   track is assumed to be in time-sorted order.  Returns the number
-//   of linked notes (note-on/note-off pairs).
+//   of linked notes (note-on/note-off pairs).  If a NoteTable is given,
+//   the notes are appended to it in note-on order (including note-ons
+//   without a note-off, which get a duration of zero).
 //
 
 int MidiEventList::linkNotePairs(void) {
-   // dimension 1: MIDI channel (0-15)
-   // dimension 2: MIDI key     (0-127)  (but 0 not used for note-ons)
-   // dimension 3: List of active note-ons or note-offs.
-   vector<vector<vector<MidiEvent*> > > noteons;
-   noteons.resize(16);
-   int i;
-   for (i=0; i<noteons.size(); i++) {
-      noteons[i].resize(128);
-   }
+   return linkNotes(NULL);
+}
 
-   // Now iterate through the MidiEventList keeping track of note
-   // states and linking notes as needed.
-   int channel;
-   int key;
-   int counter = 0;
-   MidiEvent* mev;
-   MidiEvent* noteon;
-   for (i=0; i<getSize(); i++) {
-      mev = &getEvent(i);
-      mev->unlinkEvent();
-      if (mev->isNoteOn()) {
-         // store the note-on to pair later with a note-off message.
-         key = mev->getKeyNumber();
-         channel = mev->getChannel();
-         noteons[channel][key].push_back(mev);
-      } else if (mev->isNoteOff()) {
-         key = mev->getKeyNumber();
-         channel = mev->getChannel();
-         if (noteons[channel][key].size() > 0) {
-            noteon = noteons[channel][key].back();
-            noteons[channel][key].pop_back();
-            noteon->linkEvent(mev);
-            counter++;
-         }
-      }
-   }
-   return counter;
+
+int MidiEventList::linkNotePairs(NoteTable& notes) {
+   return linkNotes(&notes);
 }
 
 
@@ -262,4 +295,79 @@ int MidiEventList::push_back_no_copy(MidiEvent* event) {
 
 
 
+//////////////////////////////
+//
+// MidiEventList::linkNotes -- Implementation of linkNotePairs().  Active
+//   note-ons form one stack per channel and key: top[] holds the most
+//   recent unmatched note-on, and the eventlink of each active note-on
+//   points to the note-on which was active below it.  A note-off pops
+//   the top of its stack, so linking needs a single pass over the events
+//   and no allocations.
+//
+
+int MidiEventList::linkNotes(NoteTable* notes) {
+   int i;
+   int count = getSize();
+   MidiEvent* top[16 * 128];
+   for (i=0; i<16 * 128; i++) {
+      top[i] = NULL;
+   }
+
+   int counter = 0;
+   int slot;
+   MidiEvent* mev;
+   MidiEvent* noteon;
+   for (i=0; i<count; i++) {
+      mev = list[i];
+      // Old links are symmetric, so an event linked to one earlier in
+      // the list has already been unlinked when that event was visited.
+      mev->unlinkEvent();
+      if (mev->size() != 3) {
+         continue;
+      }
+      int command = (*mev)[0] & 0xf0;
+      if ((command != 0x90) && (command != 0x80)) {
+         continue;
+      }
+      slot = (((*mev)[0] & 0x0f) << 7) | ((*mev)[1] & 0x7f);
+      if ((command == 0x90) && ((*mev)[2] != 0)) {
+         // push the note-on to pair later with a note-off message:
+         mev->eventlink = top[slot];
+         top[slot] = mev;
+      } else if (top[slot] != NULL) {
+         noteon = top[slot];
+         top[slot] = noteon->eventlink;
+         noteon->eventlink = mev;
+         mev->eventlink = noteon;
+         counter++;
+      }
+   }
+
+   // note-ons left on the stacks have no note-off:
+   for (i=0; i<16 * 128; i++) {
+      while (top[i] != NULL) {
+         noteon = top[i];
+         top[i] = noteon->eventlink;
+         noteon->eventlink = NULL;
+      }
+   }
+
+   if (notes != NULL) {
+      for (i=0; i<count; i++) {
+         mev = list[i];
+         if (!mev->isNoteOn()) {
+            continue;
+         }
+         if (mev->eventlink != NULL) {
+            notes->append(*mev, *mev->eventlink);
+         } else {
+            notes->append(*mev);
+         }
+      }
+   }
+
+   return counter;
+}
+
+
 
@@ -14,10 +14,13 @@
 #define _MIDIEVENTLIST_H_INCLUDED
 
 #include "MidiEvent.h"
+#include "MidiEventPool.h"
 #include <vector>
 
 using namespace std;
 
+class NoteTable;
+
 class MidiEventList {
    public:
                   MidiEventList    (void);
@@ -33,19 +36,26 @@ class MidiEventList {
       int         getSize          (void);
       int         size             (void);
       int         linkNotePairs    (void);
+      int         linkNotePairs    (NoteTable& notes);
       void        clearLinks       (void);
       MidiEvent** data             (void);
+      void        setPool          (MidiEventPool* apool);
+      MidiEventPool* getPool       (void);
 
       int         push             (MidiEvent& event);
       int         push_back        (MidiEvent& event);
       int         append           (MidiEvent& event);
+      void        remove           (int index);
 
       // careful when using these, intended for internal use in MidiFile class:
       void        detach              (void);
       int         push_back_no_copy   (MidiEvent* event);
 
    private:
+      int         linkNotes        (NoteTable* notes);
+
       vector<MidiEvent*>     list;
+      MidiEventPool*         pool;    // event storage, or NULL for heap
 
 };
 
@@ -0,0 +1,167 @@
+//
+// Filename:      midifile/src-library/MidiEventPool.cpp
+// Syntax:        C++11
+// vim:           ts=3 expandtab
+//
+// Description:   Arena storage for MidiEvents.  Events are constructed
+//                in large contiguous slabs and are all destroyed together
+//                when the pool is cleared.
+//
+
+#include "MidiEventPool.h"
+
+#include <new>
+
+using namespace std;
+
+#define DEFAULT_SLAB_EVENTS 4096
+
+
+//////////////////////////////
+//
+// MidiEventPool::MidiEventPool -- Constructor.  The optional parameter
+//    is the number of events stored in each slab.
+//
+
+MidiEventPool::MidiEventPool(void) {
+   slabsize   = DEFAULT_SLAB_EVENTS;
+   eventcount = 0;
+}
+
+
+MidiEventPool::MidiEventPool(int slabEvents) {
+   slabsize   = slabEvents > 0 ? slabEvents : DEFAULT_SLAB_EVENTS;
+   eventcount = 0;
+}
+
+
+
+//////////////////////////////
+//
+// MidiEventPool::~MidiEventPool -- Deconstructor.  Destroys all events
+//    which were allocated from the pool.
+//
+
+MidiEventPool::~MidiEventPool() {
+   clear();
+}
+
+
+
+//////////////////////////////
+//
+// MidiEventPool::allocate -- Construct a copy of the given event in the
+//    pool and return a pointer to it.  The event lives until the pool
+//    is cleared and must not be deleted by the caller.
+//
+
+MidiEvent* MidiEventPool::allocate(const MidiEvent& event) {
+   if (slabs.empty() || (slabfill.back() >= slabsize)) {
+      addSlab();
+   }
+   MidiEvent* ptr = slabs.back() + slabfill.back();
+   new (ptr) MidiEvent(event);
+   slabfill.back()++;
+   eventcount++;
+   return ptr;
+}
+
+
+
+//////////////////////////////
+//
+// MidiEventPool::clear -- Destroy all events and release the slabs in
+//    one step.  Any MidiEventList still pointing into the pool must be
+//    emptied before the pool is cleared.
+//
+
+void MidiEventPool::clear(void) {
+   for (int i=0; i<(int)slabs.size(); i++) {
+      for (int j=0; j<slabfill[i]; j++) {
+         slabs[i][j].~MidiEvent();
+      }
+      ::operator delete((void*)slabs[i]);
+   }
+   slabs.clear();
+   slabfill.clear();
+   eventcount = 0;
+}
+
+
+
+//////////////////////////////
+//
+// MidiEventPool::adopt -- Take ownership of all events in another pool,
+//    leaving the other pool empty.  Event addresses do not change, so
+//    lists filled from the other pool remain valid.
+//
+
+void MidiEventPool::adopt(MidiEventPool& other) {
+   if (&other == this) {
+      return;
+   }
+   if (other.slabs.empty()) {
+      return;
+   }
+   // Keep a partially filled slab of this pool at the end so that
+   // subsequent allocations continue to fill it.
+   int partial = !slabs.empty() && (slabfill.back() < slabsize);
+   int position = partial ? (int)slabs.size() - 1 : (int)slabs.size();
+   slabs.insert(slabs.begin() + position, other.slabs.begin(),
+         other.slabs.end());
+   slabfill.insert(slabfill.begin() + position, other.slabfill.begin(),
+         other.slabfill.end());
+   eventcount += other.eventcount;
+
+   other.slabs.clear();
+   other.slabfill.clear();
+   other.eventcount = 0;
+}
+
+
+
+//////////////////////////////
+//
+// MidiEventPool::getSize -- Return the number of events in the pool.
+//
+
+int MidiEventPool::getSize(void) {
+   return eventcount;
+}
+
+
+int MidiEventPool::size(void) {
+   return getSize();
+}
+
+
+
+//////////////////////////////
+//
+// MidiEventPool::getSlabCount -- Return the number of allocated slabs.
+//
+
+int MidiEventPool::getSlabCount(void) {
+   return slabs.size();
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////
+//
+// private functions --
+//
+
+//////////////////////////////
+//
+// MidiEventPool::addSlab -- Allocate raw storage for another slab.
+//
+
+void MidiEventPool::addSlab(void) {
+   void* storage = ::operator new(sizeof(MidiEvent) * slabsize);
+   slabs.push_back((MidiEvent*)storage);
+   slabfill.push_back(0);
+}
+
+
+
@@ -0,0 +1,50 @@
+//
+// Filename:      midifile/include/MidiEventPool.h
+// Syntax:        C++11
+// vim:           ts=3 expandtab
+//
+// Description:   Arena storage for MidiEvents.  Events are constructed
+//                in large contiguous slabs and are all destroyed together
+//                when the pool is cleared, instead of being allocated and
+//                freed one at a time.
+//
+
+#ifndef _MIDIEVENTPOOL_H_INCLUDED
+#define _MIDIEVENTPOOL_H_INCLUDED
+
+#include "MidiEvent.h"
+#include <vector>
+
+using namespace std;
+
+class MidiEventPool {
+   public:
+                   MidiEventPool   (void);
+                   MidiEventPool   (int slabEvents);
+                  ~MidiEventPool   ();
+
+      MidiEvent*   allocate        (const MidiEvent& event);
+      void         clear           (void);
+      void         adopt           (MidiEventPool& other);
+      int          getSize         (void);
+      int          size            (void);
+      int          getSlabCount    (void);
+
+   private:
+      vector<MidiEvent*>  slabs;       // raw storage for events
+      vector<int>         slabfill;    // constructed events in each slab
+      int                 slabsize;    // events per slab
+      int                 eventcount;  // total constructed events
+
+      void         addSlab         (void);
+
+      // disallow copying, since the pool owns its events:
+                   MidiEventPool   (const MidiEventPool& other);
+      MidiEventPool& operator=     (const MidiEventPool& other);
+};
+
+
+#endif /* _MIDIEVENTPOOL_H_INCLUDED */
+
+
+
@@ -29,6 +29,7 @@
 
 #include "MidiFile.h"
 #include "Binasc.h"
+#include "MappedFile.h"
 
 #include <string.h>
 #include <iostream>
@@ -36,6 +37,12 @@
 #include <fstream>
 #include <sstream>
 #include <cstdlib>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <functional>
+#include <iterator>
 
 using namespace std;
 
@@ -46,12 +53,13 @@ using namespace std;
 //
 
 MidiFile::MidiFile(void) {
+   eventpool = NULL;
    ticksPerQuarterNote = 120;            // TPQ time base of file
    trackCount = 1;                       // # of tracks in file
    theTrackState = TRACK_STATE_SPLIT;    // joined or split
    theTimeState = TIME_STATE_ABSOLUTE;   // absolute or delta
    events.resize(1);
-   events[0] = new MidiEventList;
+   events[0] = newEventList();
    readFileName.resize(1);
    readFileName[0] = '\0';
    timemap.clear();
@@ -61,12 +69,13 @@ MidiFile::MidiFile(void) {
 
 
 MidiFile::MidiFile(const char* filename) {
+   eventpool = NULL;
    ticksPerQuarterNote = 120;            // TPQ time base of file
    trackCount = 1;                       // # of tracks in file
    theTrackState = TRACK_STATE_SPLIT;    // joined or split
    theTimeState = TIME_STATE_ABSOLUTE;   // absolute or delta
    events.resize(1);
-   events[0] = new MidiEventList;
+   events[0] = newEventList();
    readFileName.resize(1);
    readFileName[0] = '\0';
    read(filename);
@@ -77,13 +86,13 @@ MidiFile::MidiFile(const char* filename) {
 
 
 MidiFile::MidiFile(const string& filename) {
-
+   eventpool = NULL;
    ticksPerQuarterNote = 120;            // TQP time base of file
    trackCount = 1;                       // # of tracks in file
    theTrackState = TRACK_STATE_SPLIT;    // joined or split
    theTimeState = TIME_STATE_DELTA;      // absolute or delta
    events.resize(1);
-   events[0] = new MidiEventList;
+   events[0] = newEventList();
    readFileName.resize(1);
    readFileName[0] = '\0';
    read(filename);
@@ -94,12 +103,13 @@ MidiFile::MidiFile(const string& filename) {
 
 
 MidiFile::MidiFile(istream& input) {
+   eventpool = NULL;
    ticksPerQuarterNote = 120;            // TQP time base of file
    trackCount = 1;                       // # of tracks in file
    theTrackState = TRACK_STATE_SPLIT;    // joined or split
    theTimeState = TIME_STATE_DELTA;      // absolute or delta
    events.resize(1);
-   events[0] = new MidiEventList;
+   events[0] = newEventList();
    readFileName.resize(1);
    readFileName[0] = '\0';
    read(input);
@@ -124,6 +134,10 @@ MidiFile::~MidiFile() {
       events[0] = NULL;
    }
    events.resize(0);
+   if (eventpool != NULL) {
+      delete eventpool;
+      eventpool = NULL;
+   }
    rwstatus = 0;
    timemap.clear();
    timemapvalid = 0;
@@ -191,20 +205,12 @@ int MidiFile::read(istream& input) {
    if (input.peek() != 'M') {
       // If the first byte in the input stream is not 'M', then presume that
       // the MIDI file is in the binasc format which is an ASCII representation
-      // of the MIDI file.  Convert the binasc content into binary content and
-      // then continue reading with this function.
-      stringstream binarydata;
-      Binasc binasc;
-      binasc.writeToBinary(binarydata, input);
-      binarydata.seekg(0, ios_base::beg);
-      if (binarydata.peek() != 'M') {
-         cerr << "Bad MIDI data input" << endl;
-	 rwstatus = 0;
-         return rwstatus;
-      } else {
-         rwstatus = read(binarydata);
-         return rwstatus;
-      }
+      // of the MIDI file.  Convert the binasc content into binary content in
+      // memory and parse the events from there.
+      string text((istreambuf_iterator<char>(input)),
+            istreambuf_iterator<char>());
+      rwstatus = readBinasc(text.data(), text.size());
+      return rwstatus;
    }
 
    const char* filename = getFilename();
@@ -308,35 +314,14 @@ int MidiFile::read(istream& input) {
    }
    events.resize(tracks);
    for (int z=0; z<tracks; z++) {
-      events[z] = new MidiEventList;
+      events[z] = newEventList();
       events[z]->reserve(10000);   // Initialize with 10,000 event storage.
       events[z]->clear();
    }
 
    // Header parameter #3: Ticks per quarter note
    shortdata = MidiFile::readLittleEndian2Bytes(input);
-   if (shortdata >= 0x8000) {
-      int framespersecond = ((!(shortdata >> 8))+1) & 0x00ff;
-      int resolution      = shortdata & 0x00ff;
-      switch (framespersecond) {
-         case 232:  framespersecond = 24; break;
-         case 231:  framespersecond = 25; break;
-         case 227:  framespersecond = 29; break;
-         case 226:  framespersecond = 30; break;
-         default:
-               cerr << "Warning: unknown FPS: " << framespersecond << endl;
-               framespersecond = 255 - framespersecond + 1;
-               cerr << "Setting FPS to " << framespersecond << endl;
-      }
-      // actually ticks per second (except for frame=29 (drop frame)):
-      ticksPerQuarterNote = shortdata;
-
-      cerr << "SMPTE ticks: " << ticksPerQuarterNote << " ticks/sec" << endl;
-      cerr << "SMPTE frames per second: " << framespersecond << endl;
-      cerr << "SMPTE frame resolution per frame: " << resolution << endl;
-   }  else {
-      ticksPerQuarterNote = shortdata;
-   }
+   setTimeDivision(shortdata);
 
 
    //////////////////////////////////////////////////
@@ -474,6 +459,276 @@ int MidiFile::read(istream& input) {
 
 
 
+//////////////////////////////
+//
+// MidiFile::readMapped -- Parse a Standard MIDI File by mapping it into
+//      memory and decoding the chunks directly from the mapped bytes
+//      instead of pulling them one at a time through an istream.
+//      The resulting tracks are identical to those from read().
+//
+
+int MidiFile::readMapped(const char* filename) {
+   rwstatus = 1;
+   timemapvalid = 0;
+   if (filename != NULL) {
+      setFilename(filename);
+   }
+
+   MappedFile input;
+   if (!input.open(filename)) {
+      rwstatus = 0;
+      return rwstatus;
+   }
+
+   rwstatus = readFromMemory(input.data(), input.size());
+   return rwstatus;
+}
+
+
+//
+// string version of readMapped().
+//
+
+int MidiFile::readMapped(const string& filename) {
+   return MidiFile::readMapped(filename.c_str());
+}
+
+
+
+//////////////////////////////
+//
+// MidiFile::readFromMemory -- Parse a Standard MIDI File which is already
+//      stored in memory (for example a mapped file or a buffer supplied
+//      by the caller).  The data is not retained after parsing.  Binasc
+//      content is converted to binary first, as in read(istream&).
+//      Malformed data causes a return value of 0 rather than exiting.
+//
+
+int MidiFile::readFromMemory(const uchar* data, size_t size) {
+   rwstatus = 1;
+   timemapvalid = 0;
+   if ((size == 0) || (data == NULL)) {
+      cerr << "Bad MIDI data input" << endl;
+      rwstatus = 0;
+      return rwstatus;
+   }
+
+   if (data[0] != 'M') {
+      // Presume binasc content.
+      rwstatus = readBinasc((const char*)data, size);
+      return rwstatus;
+   }
+
+   const uchar* ptr = data;
+   const uchar* end = data + size;
+   int tracks;
+   if (!readHeaderData(ptr, end, tracks)) {
+      rwstatus = 0; return rwstatus;
+   }
+   const char* filename = getFilename();
+
+   // now read individual tracks:
+   for (int i=0; i<tracks; i++) {
+      if ((end - ptr < 8) || (memcmp(ptr, "MTrk", 4) != 0)) {
+         cerr << "File " << filename << " is not a MIDI file" << endl;
+         cerr << "Expecting 'MTrk' at start of track " << i << endl;
+         rwstatus = 0; return rwstatus;
+      }
+      ptr += 4;
+
+      // The chunk size is only used as an allocation hint, since the
+      // track MUST end with an end-of-track meta event and many MIDI
+      // files found in the wild do not correctly give the track size.
+      ulong longdata = ((ulong)ptr[0] << 24) | ((ulong)ptr[1] << 16) |
+                       ((ulong)ptr[2] << 8)  |  (ulong)ptr[3];
+      ptr += 4;
+      if (longdata > (ulong)(end - ptr)) {
+         longdata = end - ptr;
+      }
+      events[i]->reserve(longdata/2);
+
+      if (!readTrackData(ptr, end, i, *events[i])) {
+         rwstatus = 0; return rwstatus;
+      }
+   }
+
+   theTimeState = TIME_STATE_ABSOLUTE;
+   return rwstatus;
+}
+
+
+
+//////////////////////////////
+//
+// MidiFile::readBinasc -- Parse a MIDI file given in the binasc format.
+//      The text is converted in a single pass into a buffer of binary
+//      bytes, and the events are then read from that buffer in place
+//      rather than through another stream.
+//
+
+int MidiFile::readBinasc(const char* text, size_t size) {
+   vector<uchar> binary;
+   Binasc binasc;
+   binasc.writeToBinary(binary, text, size);
+   if (binary.empty() || (binary[0] != 'M')) {
+      cerr << "Bad MIDI data input" << endl;
+      rwstatus = 0;
+      return rwstatus;
+   }
+   rwstatus = readFromMemory(binary.data(), binary.size());
+   return rwstatus;
+}
+
+
+
+//////////////////////////////
+//
+// MidiFile::readParallel -- Parse a Standard MIDI File by mapping it into
+//      memory and decoding its tracks concurrently.  threadCount is the
+//      maximum number of threads to use (0 for one per hardware thread).
+//      The resulting tracks are identical to those from read().
+//
+
+int MidiFile::readParallel(const char* filename, int threadCount) {
+   rwstatus = 1;
+   timemapvalid = 0;
+   if (filename != NULL) {
+      setFilename(filename);
+   }
+
+   MappedFile input;
+   if (!input.open(filename)) {
+      rwstatus = 0;
+      return rwstatus;
+   }
+
+   rwstatus = readFromMemoryParallel(input.data(), input.size(), threadCount);
+   return rwstatus;
+}
+
+
+//
+// string version of readParallel().
+//
+
+int MidiFile::readParallel(const string& filename, int threadCount) {
+   return MidiFile::readParallel(filename.c_str(), threadCount);
+}
+
+
+
+//////////////////////////////
+//
+// MidiFile::readFromMemoryParallel -- Parallel version of readFromMemory().
+//      The MTrk chunk table is scanned first, and then each track is
+//      decoded into its own event list by a pool of worker threads.
+//      Since the track sizes given in a file cannot be trusted, the
+//      sequential reader is used instead whenever a chunk size does not
+//      end exactly at the end-of-track message of its track.
+//
+
+int MidiFile::readFromMemoryParallel(const uchar* data, size_t size,
+      int threadCount) {
+   if ((size == 0) || (data == NULL) || (data[0] != 'M')) {
+      return readFromMemory(data, size);
+   }
+
+   rwstatus = 1;
+   timemapvalid = 0;
+   const uchar* ptr = data;
+   const uchar* end = data + size;
+   int tracks;
+   if (!readHeaderData(ptr, end, tracks)) {
+      rwstatus = 0; return rwstatus;
+   }
+
+   // scan the chunk table:
+   vector<const uchar*> starts(tracks);
+   vector<const uchar*> stops(tracks);
+   for (int i=0; i<tracks; i++) {
+      if ((end - ptr < 8) || (memcmp(ptr, "MTrk", 4) != 0)) {
+         return readFromMemory(data, size);
+      }
+      ulong longdata = ((ulong)ptr[4] << 24) | ((ulong)ptr[5] << 16) |
+                       ((ulong)ptr[6] << 8)  |  (ulong)ptr[7];
+      ptr += 8;
+      if ((longdata < 3) || (longdata > (ulong)(end - ptr)) ||
+            (memcmp(ptr + longdata - 3, "\xff\x2f\x00", 3) != 0)) {
+         // chunk size does not point to an end-of-track message
+         return readFromMemory(data, size);
+      }
+      starts[i] = ptr;
+      stops[i] = ptr + longdata;
+      ptr = stops[i];
+   }
+
+   if (threadCount <= 0) {
+      threadCount = thread::hardware_concurrency();
+   }
+   if (threadCount > tracks) {
+      threadCount = tracks;
+   }
+   if (threadCount < 1) {
+      threadCount = 1;
+   }
+
+   // MidiEventPool is not thread-safe, so each worker allocates from a
+   // pool of its own which is merged into the file's pool afterwards.
+   vector<MidiEventPool*> pools(threadCount, (MidiEventPool*)NULL);
+   if (eventpool != NULL) {
+      for (int i=0; i<threadCount; i++) {
+         pools[i] = new MidiEventPool;
+      }
+   }
+
+   vector<int> trackstatus(tracks, 0);
+   atomic<int> nexttrack(0);
+   auto worker = [&](int w) {
+      int i;
+      while ((i = nexttrack++) < tracks) {
+         MidiEventList& trackData = *events[i];
+         if (pools[w] != NULL) {
+            trackData.setPool(pools[w]);
+         }
+         trackData.reserve((stops[i] - starts[i]) / 2);
+         const uchar* tptr = starts[i];
+         // quiet: the sequential fallback reports the error
+         trackstatus[i] = readTrackData(tptr, stops[i], i, trackData, 1) &&
+               (tptr == stops[i]);
+      }
+   };
+
+   vector<thread> threads;
+   for (int i=1; i<threadCount; i++) {
+      threads.push_back(thread(worker, i));
+   }
+   worker(0);
+   for (int i=0; i<(int)threads.size(); i++) {
+      threads[i].join();
+   }
+
+   if (eventpool != NULL) {
+      for (int i=0; i<threadCount; i++) {
+         eventpool->adopt(*pools[i]);
+         delete pools[i];
+      }
+      for (int i=0; i<tracks; i++) {
+         events[i]->setPool(eventpool);
+      }
+   }
+
+   for (int i=0; i<tracks; i++) {
+      if (!trackstatus[i]) {
+         return readFromMemory(data, size);
+      }
+   }
+
+   theTimeState = TIME_STATE_ABSOLUTE;
+   return rwstatus;
+}
+
+
+
 //////////////////////////////
 //
 // MidiFile::write -- write a standard MIDI file to a file or an output
@@ -499,107 +754,120 @@ int MidiFile::write(const string& filename) {
 
 
 int MidiFile::write(ostream& out) {
-   int oldTimeState = getTickState();
-   if (oldTimeState == TIME_STATE_ABSOLUTE) {
-      deltaTicks();
+   vector<uchar> data;
+   if (!writeToMemory(data)) {
+      return 0;
    }
+   out.write((const char*)data.data(), data.size());
+   return 1;
+}
 
-   // write the header of the Standard MIDI File
-
-   char ch;
 
-   // 1. The characters "MThd"
-   ch = 'M'; out << ch;
-   ch = 'T'; out << ch;
-   ch = 'h'; out << ch;
-   ch = 'd'; out << ch;
 
-   // 2. write the size of the header (always a "6" stored in unsigned long
-   //    (4 bytes).
-   ulong longdata = 6;
-   writeBigEndianULong(out, longdata);
+//////////////////////////////
+//
+// MidiFile::writeToMemory -- Store the Standard MIDI File form of the
+//    data in a byte buffer.  The size of each track is calculated before
+//    anything is stored, so the buffer is allocated once and the bytes
+//    are written into it directly.  Delta times are calculated as the
+//    events are stored, so the tick state of the file is not changed
+//    (as it briefly was by the old writer).  End-of-track messages in
+//    the data are dropped and one is added to the end of each track.
+//
 
-   // 3. MIDI file format, type 0, 1, or 2
-   ushort shortdata;
-   shortdata = (getNumTracks() == 1) ? 0 : 1;
-   writeBigEndianUShort(out,shortdata);
+int MidiFile::writeToMemory(vector<uchar>& out) {
+   int tracks = getNumTracks();
+   int absoluteQ = isAbsoluteTicks();
 
-   // 4. write out the number of tracks.
-   shortdata = getNumTracks();
-   writeBigEndianUShort(out, shortdata);
+   size_t total = 14;
+   for (int i=0; i<tracks; i++) {
+      total += 8 + getTrackDataSize(i, absoluteQ) + 4;
+   }
+   out.resize(total);
+   uchar* ptr = out.data();
 
-   // 5. write out the number of ticks per quarternote. (avoiding SMTPE for now)
-   shortdata = getTicksPerQuarterNote();
-   writeBigEndianUShort(out, shortdata);
+   // header:
+   memcpy(ptr, "MThd", 4);
+   ptr = packBigEndian(ptr + 4, 6, 4);
+   ptr = packBigEndian(ptr, (tracks == 1) ? 0 : 1, 2);
+   ptr = packBigEndian(ptr, tracks, 2);
+   ptr = packBigEndian(ptr, getTicksPerQuarterNote(), 2);
 
-   // now write each track.
-   vector<uchar> trackdata;
-   uchar endoftrack[4] = {0, 0xff, 0x2f, 0x00};
-   int i, j, k;
-   int size;
-   for (i=0; i<getNumTracks(); i++) {
-      trackdata.reserve(123456);   // make the track data larger than
-                                   // expected data input
-      trackdata.clear();
-      for (j=0; j<(int)events[i]->size(); j++) {
-         if ((*events[i])[j].isEndOfTrack()) {
+   for (int i=0; i<tracks; i++) {
+      MidiEventList& track = *events[i];
+      memcpy(ptr, "MTrk", 4);
+      uchar* sizefield = ptr + 4;
+      uchar* start = ptr + 8;
+      ptr = start;
+
+      int lasttick = 0;
+      for (int j=0; j<track.size(); j++) {
+         MidiEvent& event = track[j];
+         int delta = absoluteQ ? event.tick - lasttick : event.tick;
+         lasttick = event.tick;
+         if (event.isEndOfTrack()) {
             // suppress end-of-track meta messages (one will be added
             // automatically after all track data has been written).
             continue;
          }
-         writeVLValue((*events[i])[j].tick, trackdata);
-         if (((*events[i])[j].getCommandByte() == 0xf0) ||
-             ((*events[i])[j].getCommandByte() == 0xf7)) {
-            // 0xf0 == Complete sysex message (0xf0 is part of the raw MIDI).
-            // 0xf7 == Raw byte message (0xf7 not part of the raw MIDI).
-            // Print the first byte of the message (0xf0 or 0xf7), then
-            // print a VLV length for the rest of the bytes in the message.
-            // In other words, when creating a 0xf0 or 0xf7 MIDI message,
-            // do not insert the VLV byte length yourself, as this code will
-            // do it for you automatically.
-            trackdata.push_back((*events[i])[j][0]); // 0xf0 or 0xf7;
-            writeVLValue((*events[i])[j].size()-1, trackdata);
-            for (k=1; k<(int)(*events[i])[j].size(); k++) {
-               trackdata.push_back((*events[i])[j][k]);
-            }
+         ptr += packVLV((ulong)(long)delta, ptr);
+         int size = (int)event.size();
+         if ((size > 0) && ((event[0] == 0xf0) || (event[0] == 0xf7))) {
+            // The length of sysex and raw byte messages is added here;
+            // see getTrackDataSize().
+            *ptr++ = event[0];
+            ptr += packVLV(size - 1, ptr);
+            memcpy(ptr, event.data() + 1, size - 1);
+            ptr += size - 1;
          } else {
-            // non-sysex type of message, so just output the
-            // bytes of the message:
-            for (k=0; k<(int)(*events[i])[j].size(); k++) {
-               trackdata.push_back((*events[i])[j][k]);
-            }
+            memcpy(ptr, event.data(), size);
+            ptr += size;
          }
       }
-      size = trackdata.size();
-      if ((size < 3) || !((trackdata[size-3] == 0xff)
-            && (trackdata[size-2] == 0x2f))) {
-         trackdata.push_back(endoftrack[0]);
-         trackdata.push_back(endoftrack[1]);
-         trackdata.push_back(endoftrack[2]);
-         trackdata.push_back(endoftrack[3]);
+
+      // The data may already end in a (raw) end-of-track message.
+      if ((ptr - start < 3) || !((ptr[-3] == 0xff) && (ptr[-2] == 0x2f))) {
+         *ptr++ = 0x00;
+         *ptr++ = 0xff;
+         *ptr++ = 0x2f;
+         *ptr++ = 0x00;
       }
+      packBigEndian(sizefield, (ulong)(ptr - start), 4);
+   }
 
-      // now ready to write to MIDI file.
+   out.resize(ptr - out.data());
+   return 1;
+}
 
-      // first write the track ID marker "MTrk":
-      ch = 'M'; out << ch;
-      ch = 'T'; out << ch;
-      ch = 'r'; out << ch;
-      ch = 'k'; out << ch;
 
-      // A. write the size of the MIDI data to follow:
-      longdata = trackdata.size();
-      writeBigEndianULong(out, longdata);
 
-      // B. write the actual data
-      out.write((char*)trackdata.data(), trackdata.size());
-   }
+//////////////////////////////
+//
+// MidiFile::getTrackDataSize -- Number of bytes which writeToMemory()
+//    stores for the events of a track, not counting the track header
+//    or the end-of-track message which is added to the track.  For
+//    sysex (0xf0) and raw byte (0xf7) messages the first byte is
+//    followed by the number of remaining bytes as a VLV, so that
+//    length should not be stored in the message itself.
+//
 
-   if (oldTimeState == TIME_STATE_ABSOLUTE) {
-      absoluteTicks();
+size_t MidiFile::getTrackDataSize(int track, int absoluteQ) {
+   MidiEventList& list = *events[track];
+   size_t size = 0;
+   int lasttick = 0;
+   for (int j=0; j<list.size(); j++) {
+      MidiEvent& event = list[j];
+      int delta = absoluteQ ? event.tick - lasttick : event.tick;
+      lasttick = event.tick;
+      if (event.isEndOfTrack()) {
+         continue;
+      }
+      size += getVLVLength((ulong)(long)delta) + event.size();
+      if ((event.size() > 0) && ((event[0] == 0xf0) || (event[0] == 0xf7))) {
+         size += getVLVLength(event.size() - 1);
+      }
    }
-
-   return 1;
+   return size;
 }
 
 
@@ -783,7 +1051,7 @@ void MidiFile::joinTracks(void) {
    }
 
    MidiEventList* joinedTrack;
-   joinedTrack = new MidiEventList;
+   joinedTrack = newEventList();
 
    int messagesum = 0;
    int length = getNumTracks();
@@ -797,18 +1065,77 @@ void MidiFile::joinTracks(void) {
    if (oldTimeState == TIME_STATE_DELTA) {
       absoluteTicks();
    }
+
+   // Merge the tracks by the sort key of their events (see eventsortkey),
+   // breaking ties by track number so that the result is the stable sort
+   // of the concatenated tracks.  Tracks are normally already in key
+   // order after reading; any which are not (after editing) are sorted
+   // first.
+   vector<vector<long long> > keys(length);
+   vector<MidiEvent**> eventdata(length);
+   vector<int> position(length, 0);
+   vector<long long> heap;
+   heap.reserve(length);
    for (i=0; i<length; i++) {
-      for (j=0; j<(int)events[i]->size(); j++) {
-         joinedTrack->push_back_no_copy(&(*events[i])[j]);
+      MidiEventList& track = *events[i];
+      int count = track.size();
+      keys[i].resize(count);
+      int sortedQ = 1;
+      for (j=0; j<count; j++) {
+         keys[i][j] = eventsortkey(track[j]);
+         if ((j > 0) && (keys[i][j] < keys[i][j-1])) {
+            sortedQ = 0;
+         }
+      }
+      if (!sortedQ) {
+         sortTrack(track);
+         for (j=0; j<count; j++) {
+            keys[i][j] = eventsortkey(track[j]);
+         }
+      }
+      eventdata[i] = track.data();
+      if (count > 0) {
+         heap.push_back(keys[i][0] * 0x10000 + i);
       }
    }
 
+   // Min-heap of the next event of each track.  Heap entries hold the
+   // sort key in the upper bits and the track number (which is at most
+   // 16 bits in a MIDI file) in the lower bits, so that the ordering of
+   // the heap is a single integer comparison.
+   make_heap(heap.begin(), heap.end(), greater<long long>());
+   int heapsize = heap.size();
+   while (heapsize > 0) {
+      int track = (int)(heap[0] & 0xffff);
+      joinedTrack->push_back_no_copy(eventdata[track][position[track]]);
+      if (++position[track] < (int)keys[track].size()) {
+         heap[0] = keys[track][position[track]] * 0x10000 + track;
+      } else {
+         heap[0] = heap[--heapsize];
+      }
+      // sift the new top of the heap down into place:
+      long long top = heap[0];
+      int parent = 0;
+      while (1) {
+         int child = 2 * parent + 1;
+         if (child >= heapsize) {
+            break;
+         }
+         child += (child + 1 < heapsize) && (heap[child + 1] < heap[child]);
+         if (heap[child] >= top) {
+            break;
+         }
+         heap[parent] = heap[child];
+         parent = child;
+      }
+      heap[parent] = top;
+   }
+
    clear_no_deallocate();
 
    delete events[0];
    events.resize(0);
    events.push_back(joinedTrack);
-   sortTracks();
    if (oldTimeState == TIME_STATE_DELTA) {
       deltaTicks();
    }
@@ -850,8 +1177,8 @@ void MidiFile::splitTracks(void) {
    MidiEventList* olddata = events[0];
    events[0] = NULL;
    events.resize(trackCount);
-   for (i=0; i<=trackCount; i++) {
-      events[i] = new MidiEventList;
+   for (i=0; i<trackCount; i++) {
+      events[i] = newEventList();
    }
 
    int trackValue = 0;
@@ -1132,13 +1459,13 @@ const char* MidiFile::getFilename(void) {
 //
 
 int MidiFile::addEvent(int aTrack, int aTime, vector<uchar>& midiData) {
-   timemapvalid = 0;
    MidiEvent anEvent;
    anEvent.tick = aTime;
    anEvent.track = aTrack;
    anEvent.setMessage(midiData);
 
    events[aTrack]->push_back(anEvent);
+   updateTimeMap(aTrack, events[aTrack]->size() - 1, 1);
    return events[aTrack]->size() - 1;
 }
 
@@ -1150,13 +1477,32 @@ int MidiFile::addEvent(int aTrack, int aTime, vector<uchar>& midiData) {
 //
 
 int MidiFile::addEvent(MidiEvent& mfevent) {
-   if (getTrackState() == TRACK_STATE_JOINED) {
-      events[0]->push_back(mfevent);
-      return events[0]->size()-1;
-   } else {
-      events[mfevent.track]->push_back(mfevent);
-      return events[mfevent.track]->size()-1;
+   int aTrack = 0;
+   if (getTrackState() != TRACK_STATE_JOINED) {
+      aTrack = mfevent.track;
+   }
+   events[aTrack]->push_back(mfevent);
+   updateTimeMap(aTrack, events[aTrack]->size() - 1, 1);
+   return events[aTrack]->size()-1;
+}
+
+
+
+//////////////////////////////
+//
+// MidiFile::removeEvent -- Remove an event from a track.  Removing a
+//    tempo message only updates the times of the events after it.
+//
+
+void MidiFile::removeEvent(int aTrack, int anIndex) {
+   if ((aTrack < 0) || (aTrack >= getTrackCount())) {
+      return;
+   }
+   if ((anIndex < 0) || (anIndex >= events[aTrack]->size())) {
+      return;
    }
+   updateTimeMap(aTrack, anIndex, 0);
+   events[aTrack]->remove(anIndex);
 }
 
 
@@ -1168,7 +1514,6 @@ int MidiFile::addEvent(MidiEvent& mfevent) {
 
 int MidiFile::addMetaEvent(int aTrack, int aTime, int aType,
       vector<uchar>& metaData) {
-   timemapvalid = 0;
    int i;
    int length = metaData.size();
    vector<uchar> fulldata;
@@ -1266,7 +1611,6 @@ int MidiFile::makeVLV(uchar *buffer, int number) {
 //
 
 int MidiFile::addPitchBend(int aTrack, int aTime, int aChannel, double amount) {
-   timemapvalid = 0;
    amount += 1.0;
    int value = int(amount * 8192 + 0.5);
 
@@ -1307,7 +1651,7 @@ int MidiFile::addPitchBend(int aTrack, int aTime, int aChannel, double amount) {
 int MidiFile::addTrack(void) {
    int length = getNumTracks();
    events.resize(length+1);
-   events[length] = new MidiEventList;
+   events[length] = newEventList();
    events[length]->reserve(10000);
    events[length]->clear();
    return length;
@@ -1318,7 +1662,7 @@ int MidiFile::addTrack(int count) {
    events.resize(length+count);
    int i;
    for (i=0; i<count; i++) {
-      events[length + i] = new MidiEventList;
+      events[length + i] = newEventList();
       events[length + i]->reserve(10000);
       events[length + i]->clear();
    }
@@ -1359,6 +1703,7 @@ void MidiFile::deleteTrack(int aTrack) {
    for (int i=aTrack; i<length-1; i++) {
       events[i] = events[i+1];
    }
+   timemapvalid = 0;
 
    events[length] = NULL;
    events.resize(length-1);
@@ -1378,8 +1723,11 @@ void MidiFile::clear(void) {
       delete events[i];
       events[i] = NULL;
    }
+   if (eventpool != NULL) {
+      eventpool->clear();
+   }
    events.resize(1);
-   events[0] = new MidiEventList;
+   events[0] = newEventList();
    timemapvalid=0;
    timemap.clear();
 }
@@ -1391,6 +1739,41 @@ void MidiFile::erase(void) {
 
 
 
+//////////////////////////////
+//
+// MidiFile::setEventPool -- Turn arena allocation of events on or off.
+//    When on, all events of the file are stored in contiguous slabs
+//    which are released together by clear() or erase() rather than
+//    being allocated and freed one at a time.  Any events already in
+//    the file are moved into (or out of) the pool, keeping note links.
+//
+
+void MidiFile::setEventPool(int state) {
+   if ((state != 0) == (eventpool != NULL)) {
+      return;
+   }
+   MidiEventPool* oldpool = eventpool;
+   eventpool = state ? new MidiEventPool : NULL;
+   moveEvents(oldpool);
+   if (oldpool != NULL) {
+      delete oldpool;
+   }
+}
+
+
+
+//////////////////////////////
+//
+// MidiFile::hasEventPool -- Returns true if events are allocated from
+//    an arena rather than individually on the heap.
+//
+
+int MidiFile::hasEventPool(void) {
+   return eventpool != NULL;
+}
+
+
+
 //////////////////////////////
 //
 // MidiFile::getEvent -- return the event at the given index in the
@@ -1460,7 +1843,7 @@ int MidiFile::getNumEvents(int aTrack) {
 
 void MidiFile::mergeTracks(int aTrack1, int aTrack2) {
    MidiEventList* mergedTrack;
-   mergedTrack = new MidiEventList;
+   mergedTrack = newEventList();
    int oldTimeState = getTickState();
    if (oldTimeState == TIME_STATE_DELTA) {
       absoluteTicks();
@@ -1476,6 +1859,7 @@ void MidiFile::mergeTracks(int aTrack1, int aTrack2) {
    }
 
    sortTrack(*mergedTrack);
+   timemapvalid = 0;
 
    delete events[aTrack1];
 
@@ -1502,6 +1886,7 @@ void MidiFile::mergeTracks(int aTrack1, int aTrack2) {
 
 void MidiFile::setTicksPerQuarterNote(int ticks) {
    ticksPerQuarterNote = ticks;
+   timemapvalid = 0;
 }
 
 //
@@ -1534,18 +1919,96 @@ void MidiFile::setMillisecondTicks(void) {
 
 //////////////////////////////
 //
-// MidiFile::sortTrack --
+// MidiFile::sortTrack -- Stable sort of the events in a track by
+//    eventsortkey() (tick, with the ordering of eventcompare() within a
+//    tick).  Each event is given a 64-bit word holding its key above its
+//    original index, and the words are ordered with an LSD radix sort
+//    over the key bits only, so the time is linear in the number of
+//    events.
 //
 
 void MidiFile::sortTrack(MidiEventList& trackData) {
-   qsort(trackData.data(), trackData.size(),
-      sizeof(MidiEvent*), eventcompare);
-}
+   int count = trackData.size();
+   if (count < 2) {
+      return;
+   }
+   MidiEvent** list = trackData.data();
 
+   vector<unsigned long long> words(count);
+   long long minkey = eventsortkey(*list[0]);
+   long long maxkey = minkey;
+   int sortedQ = 1;
+   for (int i=0; i<count; i++) {
+      long long key = eventsortkey(*list[i]);
+      if ((i > 0) && (key < (long long)words[i-1])) {
+         sortedQ = 0;
+      }
+      words[i] = (unsigned long long)key;
+      if (key < minkey) {
+         minkey = key;
+      } else if (key > maxkey) {
+         maxkey = key;
+      }
+   }
+   if (sortedQ) {
+      return;
+   }
 
+   int indexbits = 0;
+   while ((indexbits < 32) && ((1LL << indexbits) < count)) {
+      indexbits++;
+   }
+   int keybits = 0;
+   while ((keybits < 63) && ((1ULL << keybits) <= (unsigned long long)
+         (maxkey - minkey))) {
+      keybits++;
+   }
+   if (indexbits + keybits > 64) {
+      // too wide to pack into a single word
+      stable_sort(list, list + count, [](MidiEvent* a, MidiEvent* b) {
+            return eventsortkey(*a) < eventsortkey(*b);
+         });
+      return;
+   }
 
-//////////////////////////////
-//
+   for (int i=0; i<count; i++) {
+      words[i] = ((unsigned long long)((long long)words[i] - minkey)
+            << indexbits) | (unsigned long long)i;
+   }
+
+   const int radixbits = 11;
+   const int radix = 1 << radixbits;
+   vector<unsigned long long> buffer(count);
+   vector<int> offsets(radix);
+   for (int shift=indexbits; shift<indexbits+keybits; shift+=radixbits) {
+      std::fill(offsets.begin(), offsets.end(), 0);
+      for (int i=0; i<count; i++) {
+         offsets[(words[i] >> shift) & (radix - 1)]++;
+      }
+      int sum = 0;
+      for (int d=0; d<radix; d++) {
+         int digitcount = offsets[d];
+         offsets[d] = sum;
+         sum += digitcount;
+      }
+      for (int i=0; i<count; i++) {
+         buffer[offsets[(words[i] >> shift) & (radix - 1)]++] = words[i];
+      }
+      words.swap(buffer);
+   }
+
+   unsigned long long indexmask = (1ULL << indexbits) - 1;
+   vector<MidiEvent*> sorted(count);
+   for (int i=0; i<count; i++) {
+      sorted[i] = list[words[i] & indexmask];
+   }
+   std::copy(sorted.begin(), sorted.end(), list);
+}
+
+
+
+//////////////////////////////
+//
 // MidiFile::sortTracks -- sort all tracks in the MidiFile.
 //
 
@@ -1601,25 +2064,8 @@ double MidiFile::getTimeInSeconds(int tickvalue) {
       }
    }
 
-   _TickTime key;
-   key.tick    = tickvalue;
-   key.seconds = -1;
-
-   void* ptr = bsearch(&key, timemap.data(), timemap.size(),
-         sizeof(_TickTime), ticksearch);
-
-   if (ptr == NULL) {
-      // The specific tick value was not found, so do a linear
-      // search for the two tick values which occur before and
-      // after the tick value, and do a linear interpolation of
-      // the time in seconds values to figure out the final
-      // time in seconds.
-      // Since the code is not yet written, kill the program at this point:
-      cerr << "ERROR: tick value " << tickvalue << " was not found " << endl;
-      exit(1);
-   } else {
-      return ((_TickTime*)ptr)->seconds;
-   }
+   _TempoSegment& segment = timemap[findTempoSegment(tickvalue)];
+   return segment.seconds + (tickvalue - segment.tick) * segment.secondsPerTick;
 }
 
 
@@ -1627,37 +2073,28 @@ double MidiFile::getTimeInSeconds(int tickvalue) {
 //////////////////////////////
 //
 // MidiFile::getAbsoluteTickTime -- return the tick value represented
-//    by the input time in seconds.  If there is not tick entry at
-//    the given time in seconds, then interpolate between two values.
+//    by the input time in seconds: the last tick which starts at or
+//    before that time.  Returns -1 for negative times.
 //
 
 int MidiFile::getAbsoluteTickTime(double starttime) {
    if (timemapvalid == 0) {
       buildTimeMap();
       if (timemapvalid == 0) {
-         if (timemapvalid == 0) {
-            return -1.0;    // something went wrong
-         }
+         return -1;    // something went wrong
       }
    }
-
-   _TickTime key;
-   key.tick    = -1;
-   key.seconds = starttime;
-
-   void* ptr = bsearch(&key, timemap.data(), timemap.size(),
-         sizeof(_TickTime), secondsearch);
-
-   if (ptr == NULL) {
-      // The specific seconds value was not found, so do a linear
-      // search for the two time values which occur before and
-      // after the given time value, and do a linear interpolation of
-      // the time in tick values to figure out the final time in ticks.
-      return linearTickInterpolationAtSecond(starttime);
-   } else {
-      return ((_TickTime*)ptr)->tick;
+   if (starttime < 0.0) {
+      return -1;
    }
 
+   _TempoSegment& segment = timemap[findTempoSegmentAtSecond(starttime)];
+   if (segment.secondsPerTick <= 0.0) {
+      return segment.tick;
+   }
+   // Allow for rounding in the seconds of an exact tick position:
+   double ticks = (starttime - segment.seconds) / segment.secondsPerTick;
+   return segment.tick + (int)(ticks + 1.0e-6);
 }
 
 
@@ -1695,6 +2132,45 @@ int MidiFile::linkNotePairs(void) {
 }
 
 
+//
+// When a NoteTable is given, it is cleared and then filled with the
+//     notes of each track in turn (in note-on order within each track).
+//
+
+int MidiFile::linkNotePairs(NoteTable& notes) {
+   notes.clear();
+   int sum = 0;
+   for (int i=0; i<getTrackCount(); i++) {
+      if (events[i] == NULL) {
+         continue;
+      }
+      sum += events[i]->linkNotePairs(notes);
+   }
+   return sum;
+}
+
+
+
+//////////////////////////////
+//
+// MidiFile::getNoteTable -- Link the note pairs of every track and
+//     fill the table with all notes of the file in onset order (notes
+//     starting at the same tick are in track order).  The ticks are
+//     made absolute, and the time analysis is done if needed so that
+//     the seconds columns are valid.  Returns the number of notes.
+//
+
+int MidiFile::getNoteTable(NoteTable& notes) {
+   absoluteTicks();
+   if (timemapvalid == 0) {
+      doTimeAnalysis();
+   }
+   linkNotePairs(notes);
+   notes.sortByTick();
+   return notes.getSize();
+}
+
+
 
 //////////////////////////////
 //
@@ -1719,150 +2195,259 @@ void MidiFile::clearLinks(void) {
 
 //////////////////////////////
 //
-// MidiFile::linearTickInterpolationAtSecond -- return the tick value at the
-//    given input time.
+// MidiFile::buildTimeMap -- build an index of the tempo segments of the
+//      file (one entry for each tempo message, with the time in seconds
+//      at its tick), and store the time in seconds of every event.  If
+//      no tempo messages are given (or until they are given, then the
+//      tempo is set to 120 beats per minute).  If several tempo messages
+//      occur at the same tick, the last one in track order is used.  The
+//      tracks are left in their current join and tick states.
 //
 
-int MidiFile::linearTickInterpolationAtSecond(double seconds) {
-   if (timemapvalid == 0) {
-      buildTimeMap();
-      if (timemapvalid == 0) {
-         return -1.0;    // something went wrong
-      }
-   }
+void MidiFile::buildTimeMap(void) {
+   int tpq = getTicksPerQuarterNote();
+   double defaultTempo = 120.0;
 
-   int i;
-   double lasttime = timemap[timemap.size()-1].seconds;
-   // give an error value of -1 if time is out of range of data.
-   if (seconds < 0.0) {
-      return -1;
+   // collect the tempo changes in tick order:
+   _TempoSegment segment;
+   timemap.clear();
+   for (int i=0; i<getTrackCount(); i++) {
+      MidiEventList& track = *events[i];
+      int tick = 0;
+      for (int j=0; j<track.size(); j++) {
+         tick = isDeltaTicks() ? tick + track[j].tick : track[j].tick;
+         if (track[j].isTempo()) {
+            segment.secondsPerTick = track[j].getTempoSPT(tpq);
+            if (segment.secondsPerTick > 0.0) {
+               segment.tick  = tick;
+               segment.track = track[j].track;
+               timemap.push_back(segment);
+            }
+         }
+      }
    }
-   if (seconds > timemap[timemap.size()-1].seconds) {
-      return -1;
+   stable_sort(timemap.begin(), timemap.end(),
+      [](const _TempoSegment& a, const _TempoSegment& b) {
+         if (a.tick != b.tick) {
+            return a.tick < b.tick;
+         }
+         return a.track < b.track;
+      });
+
+   segment.tick           = 0;
+   segment.track          = -1;
+   segment.seconds        = 0.0;
+   segment.secondsPerTick = 60.0 / (defaultTempo * tpq);
+   timemap.insert(timemap.begin(), segment);
+   for (int i=1; i<(int)timemap.size(); i++) {
+      timemap[i].seconds = timemap[i-1].seconds +
+            (timemap[i].tick - timemap[i-1].tick) * timemap[i-1].secondsPerTick;
    }
+   timemapvalid = 1;
 
-   // Guess which side of the list is closest to target:
-   // Could do a more efficient algorithm since time values are sorted,
-   // but good enough for now...
-   int startindex = -1;
-   if (seconds < lasttime / 2) {
-      for (i=0; i<(int)timemap.size(); i++) {
-         if (timemap[i].seconds > seconds) {
-            startindex = i-1;
-            break;
-         } else if (timemap[i].seconds == seconds) {
-            startindex = i;
-            break;
+   // store the time of each event, and note the latest tick and which
+   // tracks are in tick order for updateEventTimes():
+   maxtick = 0;
+   sortedtracks.assign(getTrackCount(), 1);
+   for (int i=0; i<getTrackCount(); i++) {
+      MidiEventList& track = *events[i];
+      int tick = 0;
+      int index = 0;
+      for (int j=0; j<track.size(); j++) {
+         int lasttick = tick;
+         tick = isDeltaTicks() ? tick + track[j].tick : track[j].tick;
+         if (tick < lasttick) {
+            sortedtracks[i] = 0;
          }
-      }
-   } else {
-      for (i=(int)timemap.size()-1; i>0; i--) {
-         if (timemap[i].seconds < seconds) {
-            startindex = i+1;
-            break;
-         } else if (timemap[i].seconds == seconds) {
-            startindex = i;
-            break;
+         if (tick > maxtick) {
+            maxtick = tick;
+         }
+         // tracks are normally in tick order, so step forward from the
+         // previous segment if possible:
+         if (tick < timemap[index].tick) {
+            index = findTempoSegment(tick);
+         } else {
+            while ((index + 1 < (int)timemap.size()) &&
+                   (timemap[index + 1].tick <= tick)) {
+               index++;
+            }
          }
+         track[j].seconds = timemap[index].seconds +
+               (tick - timemap[index].tick) * timemap[index].secondsPerTick;
       }
    }
+}
 
-   if (startindex < 0) {
-      return -1;
-   }
-   if (startindex >= (int)timemap.size()-1) {
-      return -1;
-   }
 
-   double x1 = timemap[startindex].seconds;
-   double x2 = timemap[startindex+1].seconds;
-   double y1 = timemap[startindex].tick;
-   double y2 = timemap[startindex+1].tick;
-   double xi = seconds;
 
-   return (xi-x1) * ((y2-y1)/(x2-x1)) + y1;
+//////////////////////////////
+//
+// MidiFile::updateTimeMap -- Keep the time map valid after an event has
+//      been inserted into a track (insertQ = 1, after the insertion) or
+//      before it is removed (insertQ = 0).  Only tempo messages change
+//      the map, and then only the times of the later events need to be
+//      recalculated.  Otherwise the only work is to set the time of an
+//      inserted event and to keep the latest tick and the tick order of
+//      its track up to date.  Files in delta-tick state are left for a
+//      full rebuild the next time the map is needed.
+//
+
+void MidiFile::updateTimeMap(int aTrack, int anIndex, int insertQ) {
+   if (timemapvalid == 0) {
+      return;
+   }
+   if (isDeltaTicks()) {
+      timemapvalid = 0;
+      return;
+   }
+   MidiEventList& track = *events[aTrack];
+   MidiEvent& event = track[anIndex];
+   if (insertQ) {
+      if ((aTrack < (int)sortedtracks.size()) && (anIndex > 0) &&
+            (track[anIndex-1].tick > event.tick)) {
+         sortedtracks[aTrack] = 0;
+      }
+      if (event.tick > maxtick) {
+         maxtick = event.tick;
+      }
+   }
+   if (event.isTempo() &&
+         (event.getTempoSPT(getTicksPerQuarterNote()) > 0.0)) {
+      if (!updateTempoSegments(event, insertQ)) {
+         timemapvalid = 0;
+         return;
+      }
+      updateEventTimes(event.tick);
+   }
+   if (insertQ) {
+      event.seconds = getTimeInSeconds(event.tick);
+   }
 }
 
 
 
 //////////////////////////////
 //
-// MidiFile::buildTimeMap -- build an index of the absolute tick values
-//      found in a MIDI file, and their corresponding time values in
-//      seconds, taking into consideration tempo change messages.  If no
-//      tempo messages are given (or until they are given, then the
-//      tempo is set to 120 beats per minute).  If SMPTE time code is
-//      used, then ticks are actually time values.  So don't build
-//      a time map for SMPTE ticks, and just calculate the time in
-//      seconds from the tick value (1000 ticks per second SMPTE
-//      is the only mode tested (25 frames per second and 40 subframes
-//      per frame).
+// MidiFile::updateTempoSegments -- Insert or remove the tempo segment of
+//      a tempo message and recalculate the starting times of the
+//      following segments.  Returns 0 if a removed tempo message cannot
+//      be found in the map.
 //
 
-void MidiFile::buildTimeMap(void) {
-
-   // convert the MIDI file to absolute time representation
-   // in single track mode (and undo if the MIDI file was not
-   // in that state when this function was called.
-   //
-   int trackstate = getTrackState();
-   int timestate  = getTickState();
+int MidiFile::updateTempoSegments(MidiEvent& tempo, int insertQ) {
+   _TempoSegment segment;
+   segment.tick           = tempo.tick;
+   segment.track          = tempo.track;
+   segment.seconds        = 0.0;
+   segment.secondsPerTick = tempo.getTempoSPT(getTicksPerQuarterNote());
 
-   absoluteTicks();
-   joinTracks();
+   // segments after the default tempo, ordered by tick and then track:
+   auto before = [](const _TempoSegment& a, const _TempoSegment& b) {
+      if (a.tick != b.tick) {
+         return a.tick < b.tick;
+      }
+      return a.track < b.track;
+   };
+   vector<_TempoSegment>::iterator it;
+   if (insertQ) {
+      it = upper_bound(timemap.begin() + 1, timemap.end(), segment, before);
+      it = timemap.insert(it, segment);
+   } else {
+      pair<vector<_TempoSegment>::iterator,
+           vector<_TempoSegment>::iterator> range;
+      range = equal_range(timemap.begin() + 1, timemap.end(), segment, before);
+      it = range.second;
+      while ((it != range.first) &&
+             ((it-1)->secondsPerTick != segment.secondsPerTick)) {
+         it--;
+      }
+      if (it == range.first) {
+         return 0;
+      }
+      it = timemap.erase(it - 1);
+   }
 
-   int allocsize = getNumEvents(0);
-   timemap.reserve(allocsize+10);
-   timemap.clear();
+   for (int i=it-timemap.begin(); i<(int)timemap.size(); i++) {
+      timemap[i].seconds = timemap[i-1].seconds +
+            (timemap[i].tick - timemap[i-1].tick) * timemap[i-1].secondsPerTick;
+   }
+   return 1;
+}
 
-   _TickTime value;
 
-   int lasttick = 0;
-   int curtick;
-   int tickinit = 0;
 
-   int i;
-   int tpq = getTicksPerQuarterNote();
-   double defaultTempo = 120.0;
-   double secondsPerTick = 60.0 / (defaultTempo * tpq);
+//////////////////////////////
+//
+// MidiFile::updateEventTimes -- Recalculate the time in seconds of all
+//      events after the given tick (which must be in absolute ticks).
+//      Nothing is done for a tick at or after the latest event, such as
+//      a tempo change appended while recording.  Tracks in tick order
+//      are walked back from the end only as far as the given tick; the
+//      others are scanned in full.
+//
 
-   double lastsec = 0.0;
-   double cursec = 0.0;
+void MidiFile::updateEventTimes(int tick) {
+   if (tick >= maxtick) {
+      return;
+   }
+   for (int i=0; i<getTrackCount(); i++) {
+      MidiEventList& track = *events[i];
+      if ((i < (int)sortedtracks.size()) && sortedtracks[i]) {
+         for (int j=track.size()-1; (j >= 0) && (track[j].tick > tick); j--) {
+            track[j].seconds = getTimeInSeconds(track[j].tick);
+         }
+         continue;
+      }
+      for (int j=0; j<track.size(); j++) {
+         if (track[j].tick > tick) {
+            track[j].seconds = getTimeInSeconds(track[j].tick);
+         }
+      }
+   }
+}
 
-   for (i=0; i<getNumEvents(0); i++) {
-      curtick = getEvent(0, i).tick;
-      getEvent(0, i).seconds = cursec;
-      if ((curtick > lasttick) || !tickinit) {
-         tickinit = 1;
 
-         // calculate the current time in seconds:
-         cursec = lastsec + (curtick - lasttick) * secondsPerTick;
-         getEvent(0, i).seconds = cursec;
 
-         // store the new tick to second mapping
-         value.tick = curtick;
-         value.seconds = cursec;
-         timemap.push_back(value);
-         lasttick   = curtick;
-         lastsec    = cursec;
-      }
+//////////////////////////////
+//
+// MidiFile::findTempoSegment -- Return the index of the tempo segment
+//      containing the given tick (the first segment for ticks before it).
+//
 
-      // update the tempo if needed:
-      if (getEvent(0,i).isTempo()) {
-         secondsPerTick = getEvent(0,i).getTempoSPT(getTicksPerQuarterNote());
+int MidiFile::findTempoSegment(int tick) {
+   int low  = 0;
+   int high = (int)timemap.size() - 1;
+   while (low < high) {
+      int middle = (low + high + 1) / 2;
+      if (timemap[middle].tick <= tick) {
+         low = middle;
+      } else {
+         high = middle - 1;
       }
    }
+   return low;
+}
 
-   // reset the states of the tracks or time values if necessary here:
-   if (timestate == TIME_STATE_DELTA) {
-      deltaTicks();
-   }
-   if (trackstate == TRACK_STATE_SPLIT) {
-      splitTracks();
-   }
 
-   timemapvalid = 1;
 
+//////////////////////////////
+//
+// MidiFile::findTempoSegmentAtSecond -- Return the index of the tempo
+//      segment containing the given time in seconds.
+//
+
+int MidiFile::findTempoSegmentAtSecond(double seconds) {
+   int low  = 0;
+   int high = (int)timemap.size() - 1;
+   while (low < high) {
+      int middle = (low + high + 1) / 2;
+      if (timemap[middle].seconds <= seconds) {
+         low = middle;
+      } else {
+         high = middle - 1;
+      }
+   }
+   return low;
 }
 
 
@@ -1983,6 +2568,230 @@ int MidiFile::extractMidiData(istream& input, vector<uchar>& array,
 
 
 
+//////////////////////////////
+//
+// MidiFile::extractMidiData -- Extract a MIDI message from a byte span,
+//    advancing ptr past it.  Behaves like the istream version, but
+//    returns 0 on a truncated message instead of exiting.  Errors are
+//    not printed if quiet is set.
+//
+
+int MidiFile::extractMidiData(const uchar*& ptr, const uchar* end,
+      vector<uchar>& array, uchar& runningCommand, int quiet) {
+
+   array.clear();
+   if (ptr >= end) {
+      if (!quiet) {
+         cerr << "Error: unexpected end of file." << endl;
+      }
+      return 0;
+   }
+
+   uchar byte = *ptr++;
+   int runningQ;
+
+   if (byte < 0x80) {
+      runningQ = 1;
+      if (runningCommand == 0) {
+         if (!quiet) {
+            cerr << "Error: running command with no previous command"
+                 << endl;
+         }
+         return 0;
+      }
+      if (runningCommand >= 0xf0) {
+         if (!quiet) {
+            cerr << "Error: running status not permitted with meta and"
+                 << " sysex event." << endl;
+         }
+         return 0;
+      }
+   } else {
+      runningCommand = byte;
+      runningQ = 0;
+   }
+
+   array.push_back(runningCommand);
+   if (runningQ) {
+      array.push_back(byte);
+   }
+
+   // number of bytes still to be copied into the message:
+   ulong count = 0;
+
+   switch (runningCommand & 0xf0) {
+      case 0x80:        // note off (2 more bytes)
+      case 0x90:        // note on (2 more bytes)
+      case 0xA0:        // aftertouch (2 more bytes)
+      case 0xB0:        // cont. controller (2 more bytes)
+      case 0xE0:        // pitch wheel (2 more bytes)
+         count = runningQ ? 1 : 2;
+         break;
+      case 0xC0:        // patch change (1 more byte)
+      case 0xD0:        // channel pressure (1 more byte)
+         count = runningQ ? 0 : 1;
+         break;
+      case 0xF0:
+         switch (runningCommand) {
+            case 0xff:                 // meta event
+               if (end - ptr < 2) {
+                  if (!quiet) {
+                     cerr << "Error: unexpected end of file." << endl;
+                  }
+                  return 0;
+               }
+               array.push_back(*ptr++);   // meta type
+               array.push_back(*ptr);     // meta length (single byte)
+               count = *ptr++;
+               break;
+            // See the istream version of this function for a description
+            // of the 0xf0 and 0xf7 system-exclusive messages.
+            case 0xf7:
+            case 0xf0:
+               if (!readVLValue(ptr, end, count, quiet)) {
+                  return 0;
+               }
+               break;
+         }
+         break;
+      default:
+         if (!quiet) {
+            cout << "Error reading midifile" << endl;
+            cout << "Command byte was " << (int)runningCommand << endl;
+         }
+         return 0;
+   }
+
+   if (count > (ulong)(end - ptr)) {
+      if (!quiet) {
+         cerr << "Error: unexpected end of file." << endl;
+      }
+      return 0;
+   }
+   array.insert(array.end(), ptr, ptr + count);
+   ptr += count;
+   return 1;
+}
+
+
+
+//////////////////////////////
+//
+// MidiFile::readHeaderData -- Decode the MThd chunk at the start of a
+//    byte span, set the time division and allocate an empty event list
+//    for each track.  ptr is left at the first MTrk chunk.  Returns 0
+//    if the header is malformed.
+//
+
+int MidiFile::readHeaderData(const uchar*& ptr, const uchar* end,
+      int& tracks) {
+   const char* filename = getFilename();
+   size_t size = end - ptr;
+
+   // Read the MIDI header (4 bytes of ID, 4 byte data size,
+   // anticipated 6 bytes of data.
+   if ((size < 14) || (memcmp(ptr, "MThd", 4) != 0)) {
+      cerr << "File " << filename << " is not a MIDI file" << endl;
+      cerr << "Expecting 'MThd' at start of file." << endl;
+      return 0;
+   }
+   ptr += 4;
+
+   ulong longdata = ((ulong)ptr[0] << 24) | ((ulong)ptr[1] << 16) |
+                    ((ulong)ptr[2] << 8)  |  (ulong)ptr[3];
+   ptr += 4;
+   if (longdata != 6) {
+      cerr << "File " << filename
+           << " is not a MIDI 1.0 Standard MIDI file." << endl;
+      cerr << "The header size is " << longdata << " bytes." << endl;
+      return 0;
+   }
+
+   // Header parameter #1: format type
+   ushort shortdata = (ushort)((ptr[0] << 8) | ptr[1]);
+   ptr += 2;
+   int type;
+   switch (shortdata) {
+      case 0:
+         type = 0;
+         break;
+      case 1:
+         type = 1;
+         break;
+      case 2:    // Type-2 MIDI files should probably be allowed as well.
+      default:
+         cerr << "Error: cannot handle a type-" << shortdata
+              << " MIDI file" << endl;
+         return 0;
+   }
+
+   // Header parameter #2: track count
+   shortdata = (ushort)((ptr[0] << 8) | ptr[1]);
+   ptr += 2;
+   if (type == 0 && shortdata != 1) {
+      cerr << "Error: Type 0 MIDI file can only contain one track" << endl;
+      cerr << "Instead track count is: " << shortdata << endl;
+      return 0;
+   }
+   tracks = shortdata;
+
+   clear();
+   if (events[0] != NULL) {
+      delete events[0];
+   }
+   events.resize(tracks);
+   for (int z=0; z<tracks; z++) {
+      events[z] = newEventList();
+   }
+
+   // Header parameter #3: Ticks per quarter note
+   shortdata = (ushort)((ptr[0] << 8) | ptr[1]);
+   ptr += 2;
+   setTimeDivision(shortdata);
+   return 1;
+}
+
+
+
+//////////////////////////////
+//
+// MidiFile::readTrackData -- Decode the events of one MTrk chunk (after
+//    the chunk header) from a byte span into the given event list,
+//    stopping after the end-of-track meta message.  ptr is left at the
+//    byte following the track.  Returns 0 if the data is malformed; the
+//    error is not printed if quiet is set.
+//
+
+int MidiFile::readTrackData(const uchar*& ptr, const uchar* end,
+      int track, MidiEventList& trackData, int quiet) {
+   uchar runningCommand = 0;
+   MidiEvent event;
+   vector<uchar> bytes;
+   ulong delta;
+   int absticks = 0;
+
+   while (ptr < end) {
+      if (!readVLValue(ptr, end, delta, quiet)) {
+         return 0;
+      }
+      absticks += delta;
+      if (!extractMidiData(ptr, end, bytes, runningCommand, quiet)) {
+         return 0;
+      }
+      event.setMessage(bytes);
+      event.tick  = absticks;
+      event.track = track;
+      trackData.push_back(event);
+      if (bytes[0] == 0xff && bytes[1] == 0x2f) {
+         // end of track message
+         break;
+      }
+   }
+   return 1;
+}
+
+
+
 //////////////////////////////
 //
 // MidiFile::readVLValue -- The VLV value is expected to be unpacked into
@@ -2004,6 +2813,36 @@ ulong MidiFile::readVLValue(istream& input) {
 
 
 
+//
+// Byte-span version of readVLValue().  Stores the value and advances
+// ptr, returning 0 if the span ends inside the value or the value is
+// longer than 5 bytes.  Errors are not printed if quiet is set.
+//
+
+int MidiFile::readVLValue(const uchar*& ptr, const uchar* end, ulong& value,
+      int quiet) {
+   value = 0;
+   for (int i=0; i<5; i++) {
+      if (ptr >= end) {
+         if (!quiet) {
+            cerr << "Error: unexpected end of file." << endl;
+         }
+         return 0;
+      }
+      uchar byte = *ptr++;
+      value = (value << 7) | (byte & 0x7f);
+      if (byte < 0x80) {
+         return 1;
+      }
+   }
+   if (!quiet) {
+      cerr << "Error: VLV value was too long" << endl;
+   }
+   return 0;
+}
+
+
+
 //////////////////////////////
 //
 // MidiFile::unpackVLV -- converts a VLV value to an unsigned long value.
@@ -2061,6 +2900,146 @@ void MidiFile::writeVLValue(long aValue, vector<uchar>& outdata) {
 
 
 
+//////////////////////////////
+//
+// MidiFile::getVLVLength -- Number of bytes in the VLV form of a value
+//    (as stored by writeVLValue(), which keeps the lowest 35 bits).
+//
+
+int MidiFile::getVLVLength(ulong value) {
+   value &= 0x7ffffffffULL;
+   int length = 1;
+   while (value >>= 7) {
+      length++;
+   }
+   return length;
+}
+
+
+
+//////////////////////////////
+//
+// MidiFile::packVLV -- Store the VLV form of a value in the buffer,
+//    returning the number of bytes used.  The buffer must hold five
+//    bytes, or getVLVLength(value) bytes.
+//
+
+int MidiFile::packVLV(ulong value, uchar* buffer) {
+   int length = getVLVLength(value);
+   for (int i=length-1; i>0; i--) {
+      *buffer++ = (uchar)(((value >> (7 * i)) & 0x7f) | 0x80);
+   }
+   *buffer = (uchar)(value & 0x7f);
+   return length;
+}
+
+
+
+//////////////////////////////
+//
+// MidiFile::packBigEndian -- Store the lowest count bytes of a value
+//    with the most significant byte first, returning the position
+//    after the stored bytes.
+//
+
+uchar* MidiFile::packBigEndian(uchar* buffer, ulong value, int count) {
+   for (int i=count-1; i>=0; i--) {
+      *buffer++ = (uchar)((value >> (8 * i)) & 0xff);
+   }
+   return buffer;
+}
+
+
+
+//////////////////////////////
+//
+// MidiFile::setTimeDivision -- Store the time division field of the
+//    MIDI header, reporting the SMPTE settings if it is not given in
+//    ticks per quarter note.
+//
+
+void MidiFile::setTimeDivision(ushort division) {
+   if (division >= 0x8000) {
+      int framespersecond = ((!(division >> 8))+1) & 0x00ff;
+      int resolution      = division & 0x00ff;
+      switch (framespersecond) {
+         case 232:  framespersecond = 24; break;
+         case 231:  framespersecond = 25; break;
+         case 227:  framespersecond = 29; break;
+         case 226:  framespersecond = 30; break;
+         default:
+               cerr << "Warning: unknown FPS: " << framespersecond << endl;
+               framespersecond = 255 - framespersecond + 1;
+               cerr << "Setting FPS to " << framespersecond << endl;
+      }
+      // actually ticks per second (except for frame=29 (drop frame)):
+      ticksPerQuarterNote = division;
+
+      cerr << "SMPTE ticks: " << ticksPerQuarterNote << " ticks/sec" << endl;
+      cerr << "SMPTE frames per second: " << framespersecond << endl;
+      cerr << "SMPTE frame resolution per frame: " << resolution << endl;
+   }  else {
+      ticksPerQuarterNote = division;
+   }
+}
+
+
+
+//////////////////////////////
+//
+// MidiFile::newEventList -- Allocate an empty track which stores its
+//    events in the file's event pool (if arena allocation is active).
+//
+
+MidiEventList* MidiFile::newEventList(void) {
+   MidiEventList* list = new MidiEventList;
+   list->setPool(eventpool);
+   return list;
+}
+
+
+
+//////////////////////////////
+//
+// MidiFile::moveEvents -- Copy all events into storage given by the
+//    current event pool (or onto the heap if there is no pool), then
+//    release the old copies, which were stored in oldpool (or on the
+//    heap if oldpool is NULL).  Note-on/note-off links are preserved.
+//
+
+void MidiFile::moveEvents(MidiEventPool* oldpool) {
+   map<MidiEvent*, MidiEvent*> moved;
+   vector<MidiEventList*> newevents(events.size());
+   int i, j;
+   for (i=0; i<(int)events.size(); i++) {
+      newevents[i] = newEventList();
+      newevents[i]->reserve(events[i]->size());
+      for (j=0; j<events[i]->size(); j++) {
+         MidiEvent* oldevent = &(*events[i])[j];
+         newevents[i]->push_back(*oldevent);
+         MidiEvent& newevent = newevents[i]->back();
+         newevent.seconds = oldevent->seconds;
+         moved[oldevent] = &newevent;
+      }
+   }
+
+   map<MidiEvent*, MidiEvent*>::iterator it;
+   for (it = moved.begin(); it != moved.end(); it++) {
+      MidiEvent* link = it->first->getLinkedEvent();
+      if ((link != NULL) && (moved.find(link) != moved.end())) {
+         it->second->linkEvent(moved[link]);
+      }
+   }
+
+   for (i=0; i<(int)events.size(); i++) {
+      events[i]->setPool(oldpool);
+      delete events[i];
+      events[i] = newevents[i];
+   }
+}
+
+
+
 //////////////////////////////
 //
 // MidiFile::clear_no_deallocate -- Similar to clear() but does not
@@ -2077,7 +3056,7 @@ void MidiFile::clear_no_deallocate(void) {
       events[i] = NULL;
    }
    events.resize(1);
-   events[0] = new MidiEventList;
+   events[0] = newEventList();
    timemapvalid=0;
    timemap.clear();
    events.resize(0);
@@ -2094,7 +3073,34 @@ void MidiFile::clear_no_deallocate(void) {
 
 //////////////////////////////
 //
-// eventcompare -- for sorting the tracks
+// eventsortkey -- Return a key which orders events by tick and then by
+//    the message classes that eventcompare() distinguishes: meta messages
+//    after other messages and end-of-track last of all, and note-ons
+//    after all other channel messages at the same tick (so that pitch
+//    bends and note-offs come before them).  Used by sortTrack() and
+//    joinTracks().
+//
+
+long long eventsortkey(MidiEvent& event) {
+   int rank;
+   if (event.size() == 0) {
+      rank = 0;
+   } else if (event[0] == 0xff) {
+      rank = ((event.size() > 1) && (event[1] == 0x2f)) ? 3 : 2;
+   } else if ((event[0] & 0xf0) == 0x90) {
+      rank = 1;
+   } else {
+      rank = 0;
+   }
+   return (long long)event.tick * 4 + rank;
+}
+
+
+
+//////////////////////////////
+//
+// eventcompare -- for sorting the tracks (with qsort).  MidiFile::sortTrack
+//    and MidiFile::joinTracks use eventsortkey() instead.
 //
 
 int eventcompare(const void* a, const void* b) {
@@ -2218,43 +3224,6 @@ ostream& operator<<(ostream& out, MidiFile& aMidiFile) {
 
 
 
-//////////////////////////////
-//
-// MidiFile::ticksearch -- for finding a tick entry in the time map.
-//
-
-int MidiFile::ticksearch(const void* A, const void* B) {
-   _TickTime& a = *((_TickTime*)A);
-   _TickTime& b = *((_TickTime*)B);
-
-   if (a.tick < b.tick) {
-      return -1;
-   } else if (a.tick > b.tick) {
-      return 1;
-   }
-   return 0;
-}
-
-
-
-//////////////////////////////
-//
-// MidiFile::secondsearch -- for finding a second entry in the time map.
-//
-
-int MidiFile::secondsearch(const void* A, const void* B) {
-   _TickTime& a = *((_TickTime*)A);
-   _TickTime& b = *((_TickTime*)B);
-
-   if (a.seconds < b.seconds) {
-      return -1;
-   } else if (a.seconds > b.seconds) {
-      return 1;
-   }
-   return 0;
-}
-
-
 ///////////////////////////////////////////////////////////////////////////
 //
 // Static functions:
@@ -28,10 +28,12 @@
 #define _MIDIFILE_H_INCLUDED
 
 #include "MidiEventList.h"
+#include "NoteTable.h"
 
 #include <vector>
 #include <istream>
 #include <fstream>
+#include <cstddef>
 
 using namespace std;
 
@@ -41,10 +43,13 @@ using namespace std;
 #define TRACK_STATE_SPLIT      0
 #define TRACK_STATE_JOINED     1
 
-class _TickTime {
+// A span of ticks played at one tempo, starting at a tempo change:
+class _TempoSegment {
    public:
-      int    tick;
-      double seconds;
+      int    tick;              // first tick of the segment
+      int    track;             // track of the tempo message (-1 if none)
+      double seconds;           // time in seconds at that tick
+      double secondsPerTick;    // tempo until the next segment
 };
 
 
@@ -60,9 +65,19 @@ class MidiFile {
       int       read                      (const char* aFile);
       int       read                      (const string& aFile);
       int       read                      (istream& istream);
+      int       readMapped                (const char* aFile);
+      int       readMapped                (const string& aFile);
+      int       readFromMemory            (const uchar* data, size_t size);
+      int       readParallel              (const char* aFile,
+                                           int threadCount = 0);
+      int       readParallel              (const string& aFile,
+                                           int threadCount = 0);
+      int       readFromMemoryParallel    (const uchar* data, size_t size,
+                                           int threadCount = 0);
       int       write                     (const char* aFile);
       int       write                     (const string& aFile);
       int       write                     (ostream& out);
+      int       writeToMemory             (vector<uchar>& out);
       int       writeHex                  (const char* aFile,   int width = 25);
       int       writeHex                  (const string& aFile, int width = 25);
       int       writeHex                  (ostream& out,        int width = 25);
@@ -121,6 +136,8 @@ class MidiFile {
 
       // note-analysis functions:
       int 	linkNotePairs             (void);
+      int       linkNotePairs             (NoteTable& notes);
+      int       getNoteTable              (NoteTable& notes);
       void      clearLinks                (void);
 
       // filename functions:
@@ -133,6 +150,7 @@ class MidiFile {
       int       addEvent                  (int aTrack, int aTime, 
                                              vector<uchar>& midiData);
       int       addEvent                  (MidiEvent& mfevent);
+      void      removeEvent               (int aTrack, int anIndex);
       int       addMetaEvent              (int aTrack, int aTime, int aType,
                                              vector<uchar>& metaData);
       int       addMetaEvent              (int aTrack, int aTime, int aType,
@@ -144,9 +162,22 @@ class MidiFile {
       void      clear_no_deallocate       (void);
       MidiEvent&  getEvent                (int aTrack, int anIndex);
 
+      // event storage functions:
+      void      setEventPool              (int state);
+      int       hasEventPool              (void);
+
 
 
       // static functions:
+      static int      extractMidiData         (const uchar*& ptr,
+                                               const uchar* end,
+                                               vector<uchar>& array,
+                                               uchar& runningCommand,
+                                               int quiet = 0);
+      static int      readVLValue             (const uchar*& ptr,
+                                               const uchar* end,
+                                               ulong& value,
+                                               int quiet = 0);
       static uchar    readByte                (istream& input);
       static ushort   readLittleEndian2Bytes  (istream& input);
       static ulong    readLittleEndian4Bytes  (istream& input);
@@ -172,24 +203,43 @@ class MidiFile {
       vector<char>     readFileName;             // read file name
 
       int               timemapvalid;    
-      vector<_TickTime> timemap;
+      vector<_TempoSegment> timemap;             // one entry per tempo
+      int               maxtick;                 // latest tick [valid map]
+      vector<char>      sortedtracks;            // tracks in tick order
       int               rwstatus;                // read/write success flag
+      MidiEventPool*    eventpool;               // arena for events, or NULL
 
    private:
       int        extractMidiData  (istream& inputfile, vector<uchar>& array, 
                                        uchar& runningCommand);
+      int        readHeaderData   (const uchar*& ptr, const uchar* end,
+                                       int& tracks);
+      int        readBinasc       (const char* text, size_t size);
+      int        readTrackData    (const uchar*& ptr, const uchar* end,
+                                       int track, MidiEventList& trackData,
+                                       int quiet = 0);
       ulong      readVLValue      (istream& inputfile);
+      void       setTimeDivision  (ushort division);
+      MidiEventList* newEventList (void);
+      void       moveEvents       (MidiEventPool* oldpool);
       ulong      unpackVLV        (uchar a, uchar b, uchar c, uchar d, uchar e);
       void       writeVLValue     (long aValue, vector<uchar>& data);
+      size_t     getTrackDataSize (int track, int absoluteQ);
+      static int getVLVLength     (ulong value);
+      static int packVLV          (ulong value, uchar* buffer);
+      static uchar* packBigEndian (uchar* buffer, ulong value, int count);
       int        makeVLV          (uchar *buffer, int number);
-      static int ticksearch       (const void* A, const void* B);
-      static int secondsearch     (const void* A, const void* B);
       void       buildTimeMap     (void);
-      int        linearTickInterpolationAtSecond  (double seconds);
+      void       updateTimeMap    (int aTrack, int anIndex, int insertQ);
+      int        updateTempoSegments (MidiEvent& tempo, int insertQ);
+      void       updateEventTimes (int tick);
+      int        findTempoSegment (int tick);
+      int        findTempoSegmentAtSecond (double seconds);
 };
 
 
 int eventcompare(const void* a, const void* b);
+long long eventsortkey(MidiEvent& event);
 ostream& operator<<(ostream& out, MidiFile& aMidiFile);
 
 #endif /* _MIDIFILE_H_INCLUDED */
@@ -0,0 +1,574 @@
+//
+// Filename:      midifile/src-library/MidiStreamReader.cpp
+// Syntax:        C++11
+// vim:           ts=3 expandtab
+//
+// Description:   Pull-style reader for Standard MIDI Files.  Events are
+//                decoded one at a time, either per track or merged
+//                across all tracks in time order.
+//
+
+#include "MidiStreamReader.h"
+#include "MidiFile.h"
+#include "Binasc.h"
+
+#include <algorithm>
+#include <iostream>
+#include <string.h>
+
+using namespace std;
+
+
+///////////////////////////////////////////////////////////////////////////
+//
+// MidiTrackReader --
+//
+
+//////////////////////////////
+//
+// MidiTrackReader::MidiTrackReader -- Constructor.
+//
+
+MidiTrackReader::MidiTrackReader(void) {
+   setData(NULL, NULL, 0);
+}
+
+
+
+//////////////////////////////
+//
+// MidiTrackReader::setData -- Attach the reader to the data of a track
+//    (the bytes following the MTrk chunk header).
+//
+
+void MidiTrackReader::setData(const uchar* start, const uchar* stop,
+      int aTrack) {
+   begin = start;
+   end   = stop;
+   track = aTrack;
+   rewind();
+}
+
+
+
+//////////////////////////////
+//
+// MidiTrackReader::next -- Decode the next event of the track.  The
+//    tick of the event is in absolute time.  Returns 1 if an event was
+//    decoded, or 0 after the end-of-track message or on an error.
+//
+
+int MidiTrackReader::next(MidiEvent& event) {
+   if (finishedQ) {
+      return 0;
+   }
+   if (ptr >= end) {
+      // track data ended without an end-of-track message
+      finishedQ = 1;
+      return 0;
+   }
+   ulong delta;
+   if (!MidiFile::readVLValue(ptr, end, delta) ||
+         !MidiFile::extractMidiData(ptr, end, bytes, runningCommand)) {
+      errorQ = 1;
+      finishedQ = 1;
+      return 0;
+   }
+   tick += delta;
+   event.unlinkEvent();
+   event.setMessage(bytes);
+   event.tick    = tick;
+   event.track   = track;
+   event.seconds = 0.0;
+   if ((bytes[0] == 0xff) && (bytes[1] == 0x2f)) {
+      finishedQ = 1;
+   }
+   return 1;
+}
+
+
+
+//////////////////////////////
+//
+// MidiTrackReader::rewind -- Go back to the start of the track.
+//
+
+void MidiTrackReader::rewind(void) {
+   ptr            = begin;
+   tick           = 0;
+   runningCommand = 0;
+   finishedQ      = (begin == NULL);
+   errorQ         = 0;
+}
+
+
+
+//////////////////////////////
+//
+// MidiTrackReader::isFinished -- Returns true when there are no more
+//    events in the track.
+//
+
+int MidiTrackReader::isFinished(void) {
+   return finishedQ;
+}
+
+
+
+//////////////////////////////
+//
+// MidiTrackReader::hasError -- Returns true if the track data was found
+//    to be malformed.
+//
+
+int MidiTrackReader::hasError(void) {
+   return errorQ;
+}
+
+
+
+//////////////////////////////
+//
+// MidiTrackReader::getTrack -- Return the track index of the reader.
+//
+
+int MidiTrackReader::getTrack(void) {
+   return track;
+}
+
+
+
+//////////////////////////////
+//
+// MidiTrackReader::getPosition -- Return a pointer to the next byte to
+//    be decoded (just after the end-of-track message once finished).
+//
+
+const uchar* MidiTrackReader::getPosition(void) {
+   return ptr;
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////
+//
+// MidiStreamReader --
+//
+
+//////////////////////////////
+//
+// MidiStreamReader::MidiStreamReader -- Constructor.
+//
+
+MidiStreamReader::MidiStreamReader(void) {
+   data   = NULL;
+   length = 0;
+   tpq    = 120;
+   openQ  = 0;
+   startedQ = 0;
+}
+
+
+MidiStreamReader::MidiStreamReader(const char* aFile) {
+   data   = NULL;
+   length = 0;
+   tpq    = 120;
+   openQ  = 0;
+   startedQ = 0;
+   open(aFile);
+}
+
+
+MidiStreamReader::MidiStreamReader(const string& aFile) {
+   data   = NULL;
+   length = 0;
+   tpq    = 120;
+   openQ  = 0;
+   startedQ = 0;
+   open(aFile.c_str());
+}
+
+
+
+//////////////////////////////
+//
+// MidiStreamReader::~MidiStreamReader -- Deconstructor.
+//
+
+MidiStreamReader::~MidiStreamReader() {
+   close();
+}
+
+
+
+//////////////////////////////
+//
+// MidiStreamReader::open -- Map a MIDI file (or use a caller-supplied
+//    byte span, which must remain valid while reading) and locate its
+//    tracks.  No events are decoded until they are requested.  Returns
+//    1 on success, 0 if the data is not a readable MIDI file.
+//
+
+int MidiStreamReader::open(const char* aFile) {
+   close();
+   if (!file.open(aFile)) {
+      return 0;
+   }
+   return open(file.data(), file.size());
+}
+
+
+int MidiStreamReader::open(const string& aFile) {
+   return open(aFile.c_str());
+}
+
+
+int MidiStreamReader::open(const uchar* bytes, size_t size) {
+   openQ  = 0;
+   data   = bytes;
+   length = size;
+   tracks.clear();
+   converted.clear();
+
+   if ((data != NULL) && (length > 0) && (data[0] != 'M')) {
+      // Presume binasc content and convert it to binary first.
+      Binasc binasc;
+      binasc.writeToBinary(converted, (const char*)data, length);
+      data   = converted.data();
+      length = converted.size();
+   }
+
+   openQ = parseHeader();
+   rewind();
+   return openQ;
+}
+
+
+
+//////////////////////////////
+//
+// MidiStreamReader::close -- Release the input data.
+//
+
+void MidiStreamReader::close(void) {
+   tracks.clear();
+   cursors.clear();
+   pending.clear();
+   heap.clear();
+   converted.clear();
+   file.close();
+   data     = NULL;
+   length   = 0;
+   openQ    = 0;
+   startedQ = 0;
+}
+
+
+
+//////////////////////////////
+//
+// MidiStreamReader::status -- Returns true if the input was opened
+//    successfully and no malformed track data has been found since.
+//
+
+int MidiStreamReader::status(void) {
+   return openQ && !hasError();
+}
+
+
+
+//////////////////////////////
+//
+// MidiStreamReader::hasError -- Returns true if any track cursor, or the
+//    merged cursor, stopped on malformed data.  A track which ends on an
+//    error looks finished to the merged cursor, so callers should check
+//    this after next() returns 0 before trusting the events read.
+//
+
+int MidiStreamReader::hasError(void) {
+   for (int i=0; i<(int)tracks.size(); i++) {
+      if (tracks[i].hasError()) {
+         return 1;
+      }
+   }
+   for (int i=0; i<(int)cursors.size(); i++) {
+      if (cursors[i].hasError()) {
+         return 1;
+      }
+   }
+   return 0;
+}
+
+
+
+//////////////////////////////
+//
+// MidiStreamReader::getTrackCount -- Return the number of tracks.
+//
+
+int MidiStreamReader::getTrackCount(void) {
+   return tracks.size();
+}
+
+
+
+//////////////////////////////
+//
+// MidiStreamReader::getTicksPerQuarterNote -- Return the time base.
+//
+
+int MidiStreamReader::getTicksPerQuarterNote(void) {
+   return tpq;
+}
+
+
+int MidiStreamReader::getTPQ(void) {
+   return getTicksPerQuarterNote();
+}
+
+
+
+//////////////////////////////
+//
+// MidiStreamReader::getTrack -- Return the cursor of a single track.
+//    Track cursors are independent of the merged cursor.
+//
+
+MidiTrackReader& MidiStreamReader::getTrack(int aTrack) {
+   return tracks[aTrack];
+}
+
+
+MidiTrackReader& MidiStreamReader::operator[](int aTrack) {
+   return tracks[aTrack];
+}
+
+
+
+//////////////////////////////
+//
+// MidiStreamReader::next -- Return the next event across all tracks in
+//    tick order; events at the same tick are returned in track order.
+//    The seconds field of the event is filled in from the tempo
+//    messages seen so far.  Returns 0 when all tracks are finished.
+//    Malformed data in any track ends the whole stream there, and
+//    hasError() then returns true.
+//
+
+int MidiStreamReader::next(MidiEvent& event) {
+   if (!openQ) {
+      return 0;
+   }
+   if (!startedQ) {
+      startMerge();
+   }
+   if (heap.empty()) {
+      return 0;
+   }
+
+   auto later = [this](int a, int b) { return isLater(a, b); };
+   pop_heap(heap.begin(), heap.end(), later);
+   int track = heap.back();
+   heap.pop_back();
+
+   event = pending[track];
+   if (event.tick > lasttick) {
+      lastsec += (event.tick - lasttick) * secondsPerTick;
+      lasttick = event.tick;
+   }
+   event.seconds = lastsec;
+   if (event.isTempo()) {
+      // a tempo of zero is ignored, as in MidiFile::doTimeAnalysis()
+      double spt = event.getTempoSPT(tpq);
+      if (spt > 0.0) {
+         secondsPerTick = spt;
+      }
+   }
+
+   fillPending(track);
+   if (cursors[track].hasError()) {
+      // stop the whole stream rather than merge a truncated track
+      heap.clear();
+      return 1;
+   }
+   if (pending[track].size() > 0) {
+      heap.push_back(track);
+      push_heap(heap.begin(), heap.end(), later);
+   }
+   return 1;
+}
+
+
+
+//////////////////////////////
+//
+// MidiStreamReader::rewind -- Restart the merged cursor and all track
+//    cursors from the beginning of the file.
+//
+
+void MidiStreamReader::rewind(void) {
+   for (int i=0; i<(int)tracks.size(); i++) {
+      tracks[i].rewind();
+   }
+   cursors.clear();
+   pending.clear();
+   heap.clear();
+   startedQ       = 0;
+   lasttick       = 0;
+   lastsec        = 0.0;
+   secondsPerTick = 60.0 / (120.0 * tpq);
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////
+//
+// private functions --
+//
+
+//////////////////////////////
+//
+// MidiStreamReader::parseHeader -- Read the MThd chunk and locate the
+//    track chunks.
+//
+
+int MidiStreamReader::parseHeader(void) {
+   if ((data == NULL) || (length < 14) || (memcmp(data, "MThd", 4) != 0)) {
+      cerr << "Error: input is not a MIDI file" << endl;
+      return 0;
+   }
+   ulong headersize = ((ulong)data[4] << 24) | ((ulong)data[5] << 16) |
+                      ((ulong)data[6] << 8)  |  (ulong)data[7];
+   if (headersize != 6) {
+      cerr << "Error: input is not a MIDI 1.0 Standard MIDI file" << endl;
+      return 0;
+   }
+   int type  = (data[8] << 8)  | data[9];
+   int count = (data[10] << 8) | data[11];
+   tpq       = (data[12] << 8) | data[13];
+   if ((type != 0) && (type != 1)) {
+      cerr << "Error: cannot handle a type-" << type << " MIDI file" << endl;
+      return 0;
+   }
+   if ((type == 0) && (count != 1)) {
+      cerr << "Error: Type 0 MIDI file can only contain one track" << endl;
+      return 0;
+   }
+   secondsPerTick = 60.0 / (120.0 * tpq);
+   return locateTracks(data + 14, count);
+}
+
+
+
+//////////////////////////////
+//
+// MidiStreamReader::locateTracks -- Find the start of each track.  The
+//    MTrk chunk sizes are used if they are consistent; otherwise each
+//    track is skimmed up to its end-of-track message to find the next
+//    one, since many files in the wild give incorrect chunk sizes.
+//
+
+int MidiStreamReader::locateTracks(const uchar* ptr, int count) {
+   const uchar* end = data + length;
+   tracks.resize(count);
+
+   const uchar* chunk = ptr;
+   int i;
+   for (i=0; i<count; i++) {
+      if ((end - chunk < 8) || (memcmp(chunk, "MTrk", 4) != 0)) {
+         break;
+      }
+      ulong size = ((ulong)chunk[4] << 24) | ((ulong)chunk[5] << 16) |
+                   ((ulong)chunk[6] << 8)  |  (ulong)chunk[7];
+      if (size > (ulong)(end - chunk - 8)) {
+         break;
+      }
+      tracks[i].setData(chunk + 8, chunk + 8 + size, i);
+      chunk += 8 + size;
+   }
+   if (i == count) {
+      return 1;
+   }
+
+   // Chunk sizes cannot be trusted: skim the tracks instead.
+   MidiEvent event;
+   chunk = ptr;
+   for (i=0; i<count; i++) {
+      if ((end - chunk < 8) || (memcmp(chunk, "MTrk", 4) != 0)) {
+         cerr << "Error: expecting 'MTrk' at start of track " << i << endl;
+         tracks.clear();
+         return 0;
+      }
+      const uchar* start = chunk + 8;
+      tracks[i].setData(start, end, i);
+      while (tracks[i].next(event)) {
+         // skip to the end of the track
+      }
+      if (tracks[i].hasError()) {
+         tracks.clear();
+         return 0;
+      }
+      chunk = tracks[i].getPosition();
+      tracks[i].setData(start, chunk, i);
+   }
+   return 1;
+}
+
+
+
+//////////////////////////////
+//
+// MidiStreamReader::startMerge -- Prime the merged cursor with the first
+//    event of each track.
+//
+
+void MidiStreamReader::startMerge(void) {
+   cursors = tracks;
+   pending.resize(cursors.size());
+   heap.clear();
+   for (int i=0; i<(int)cursors.size(); i++) {
+      cursors[i].rewind();
+      fillPending(i);
+      if (pending[i].size() > 0) {
+         heap.push_back(i);
+      }
+   }
+   if (hasError()) {
+      heap.clear();
+   }
+   auto later = [this](int a, int b) { return isLater(a, b); };
+   make_heap(heap.begin(), heap.end(), later);
+   startedQ = 1;
+}
+
+
+
+//////////////////////////////
+//
+// MidiStreamReader::fillPending -- Decode the next event of a track into
+//    its pending slot, leaving the slot empty if the track is finished.
+//
+
+void MidiStreamReader::fillPending(int aTrack) {
+   if (!cursors[aTrack].next(pending[aTrack])) {
+      pending[aTrack].resize(0);
+   }
+}
+
+
+
+//////////////////////////////
+//
+// MidiStreamReader::isLater -- Heap ordering of the merged cursor: true
+//    if the pending event of track a comes after that of track b.
+//
+
+int MidiStreamReader::isLater(int a, int b) {
+   if (pending[a].tick != pending[b].tick) {
+      return pending[a].tick > pending[b].tick;
+   }
+   return a > b;
+}
+
+
+
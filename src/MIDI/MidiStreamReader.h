@@ -0,0 +1,105 @@
+//
+// Filename:      midifile/include/MidiStreamReader.h
+// Syntax:        C++11
+// vim:           ts=3 expandtab
+//
+// Description:   Pull-style reader for Standard MIDI Files.  Events are
+//                decoded one at a time, either per track or merged
+//                across all tracks in time order, without building the
+//                MidiEventLists of a MidiFile.  Memory use does not grow
+//                with the length of the file.
+//
+
+#ifndef _MIDISTREAMREADER_H_INCLUDED
+#define _MIDISTREAMREADER_H_INCLUDED
+
+#include "MidiEvent.h"
+#include "MappedFile.h"
+
+#include <vector>
+#include <string>
+#include <cstddef>
+
+using namespace std;
+
+
+class MidiTrackReader {
+   public:
+                  MidiTrackReader  (void);
+
+      void        setData          (const uchar* start, const uchar* stop,
+                                    int aTrack);
+      int         next             (MidiEvent& event);
+      void        rewind           (void);
+      int         isFinished       (void);
+      int         hasError         (void);
+      int         getTrack         (void);
+      const uchar* getPosition     (void);
+
+   private:
+      const uchar*   begin;        // first byte after the MTrk header
+      const uchar*   ptr;          // next byte to decode
+      const uchar*   end;          // end of the available data
+      int            track;        // track index stored in events
+      int            tick;         // absolute tick of last event
+      uchar          runningCommand;
+      int            finishedQ;
+      int            errorQ;
+      vector<uchar>  bytes;        // scratch space for message bytes
+};
+
+
+class MidiStreamReader {
+   public:
+                  MidiStreamReader (void);
+                  MidiStreamReader (const char* aFile);
+                  MidiStreamReader (const string& aFile);
+                 ~MidiStreamReader ();
+
+      int         open             (const char* aFile);
+      int         open             (const string& aFile);
+      int         open             (const uchar* data, size_t size);
+      void        close            (void);
+      int         status           (void);
+      int         hasError         (void);
+
+      int         getTrackCount    (void);
+      int         getTicksPerQuarterNote (void);
+      int         getTPQ           (void);
+      MidiTrackReader& getTrack    (int aTrack);
+      MidiTrackReader& operator[]  (int aTrack);
+
+      // merged cursor over all tracks:
+      int         next             (MidiEvent& event);
+      void        rewind           (void);
+
+   private:
+      MappedFile              file;
+      vector<uchar>           converted;   // binary form of binasc input
+      const uchar*            data;
+      size_t                  length;
+      int                     tpq;
+      int                     openQ;
+      vector<MidiTrackReader> tracks;
+
+      // state of the merged cursor:
+      vector<MidiTrackReader> cursors;     // private copies of tracks
+      vector<MidiEvent>       pending;     // next event of each track
+      vector<int>             heap;        // tracks ordered by next event
+      int                     startedQ;
+      int                     lasttick;
+      double                  lastsec;
+      double                  secondsPerTick;
+
+      int         parseHeader      (void);
+      int         locateTracks     (const uchar* ptr, int count);
+      void        startMerge       (void);
+      void        fillPending      (int aTrack);
+      int         isLater          (int a, int b);
+};
+
+
+#endif /* _MIDISTREAMREADER_H_INCLUDED */
+
+
+
@@ -0,0 +1,219 @@
+//
+// Filename:      midifile/src-library/NoteTable.cpp
+// Syntax:        C++11
+// vim:           ts=3 expandtab
+//
+// Description:   Column-wise (structure of arrays) table of notes.
+//
+
+#include "NoteTable.h"
+
+#include <algorithm>
+
+using namespace std;
+
+
+//////////////////////////////
+//
+// NoteTable::NoteTable -- Constructor.
+//
+
+NoteTable::NoteTable(void) {
+   // do nothing
+}
+
+
+
+//////////////////////////////
+//
+// NoteTable::~NoteTable -- Deconstructor.
+//
+
+NoteTable::~NoteTable() {
+   // do nothing
+}
+
+
+
+//////////////////////////////
+//
+// NoteTable::clear -- Remove all notes.  The storage of the columns is
+//    kept so that a table can be refilled without reallocating.
+//
+
+void NoteTable::clear(void) {
+   tick.clear();
+   duration.clear();
+   seconds.clear();
+   durationSeconds.clear();
+   key.clear();
+   velocity.clear();
+   channel.clear();
+   track.clear();
+   activeTop.clear();
+   activeBelow.clear();
+}
+
+
+
+//////////////////////////////
+//
+// NoteTable::reserve -- Reserve storage for the given number of notes
+//    in every column.
+//
+
+void NoteTable::reserve(int rsize) {
+   tick.reserve(rsize);
+   duration.reserve(rsize);
+   seconds.reserve(rsize);
+   durationSeconds.reserve(rsize);
+   key.reserve(rsize);
+   velocity.reserve(rsize);
+   channel.reserve(rsize);
+   track.reserve(rsize);
+}
+
+
+
+//////////////////////////////
+//
+// NoteTable::getSize -- Return the number of notes in the table.
+//
+
+int NoteTable::getSize(void) {
+   return (int)tick.size();
+}
+
+
+int NoteTable::size(void) {
+   return getSize();
+}
+
+
+
+//////////////////////////////
+//
+// NoteTable::append -- Add a note from a note-on and its note-off.  The
+//    events are expected to be in absolute tick time, and the seconds
+//    columns are only meaningful if the seconds of the events are (see
+//    MidiFile::doTimeAnalysis()).  A note-on without a note-off is added
+//    with a duration of zero.  Returns the index of the new note.
+//
+
+int NoteTable::append(MidiEvent& noteon, MidiEvent& noteoff) {
+   tick.push_back(noteon.tick);
+   duration.push_back(noteoff.tick - noteon.tick);
+   seconds.push_back(noteon.seconds);
+   durationSeconds.push_back(noteoff.seconds - noteon.seconds);
+   key.push_back(noteon[1] & 0x7f);
+   velocity.push_back(noteon[2]);
+   channel.push_back(noteon[0] & 0x0f);
+   track.push_back((ushort)noteon.track);
+   return getSize() - 1;
+}
+
+
+int NoteTable::append(MidiEvent& noteon) {
+   return append(noteon, noteon);
+}
+
+
+
+//////////////////////////////
+//
+// NoteTable::sortByTick -- Put the notes in onset order.  The sort is
+//    stable, so notes starting at the same tick keep their order (for
+//    the tables filled by MidiFile, that is track order).
+//
+
+void NoteTable::sortByTick(void) {
+   int count = getSize();
+   if (is_sorted(tick.begin(), tick.end())) {
+      return;
+   }
+   vector<int> order(count);
+   for (int i=0; i<count; i++) {
+      order[i] = i;
+   }
+   stable_sort(order.begin(), order.end(),
+         [this](int a, int b) { return tick[a] < tick[b]; });
+
+   permute(tick, order);
+   permute(duration, order);
+   permute(seconds, order);
+   permute(durationSeconds, order);
+   permute(key, order);
+   permute(velocity, order);
+   permute(channel, order);
+   permute(track, order);
+}
+
+
+
+//////////////////////////////
+//
+// NoteTable::addEvent -- Add one event of a stream in time order, such
+//    as the merged events of MidiStreamReader::next().  A note-on adds
+//    a note with a duration of zero; a note-off sets the duration of
+//    the latest open note-on of its track, channel and key, as
+//    MidiFile::linkNotePairs() pairs them.  Other events are ignored.
+//    Notes are added in onset order, and notes at the same tick in the
+//    order of the stream, so the table matches MidiFile::getNoteTable()
+//    without sorting.  Returns the index of the note added or ended, or
+//    -1.  Call clear() before streaming another file.
+//
+
+int NoteTable::addEvent(MidiEvent& event) {
+   int noteon = event.isNoteOn();
+   if (!noteon && !event.isNoteOff()) {
+      return -1;
+   }
+   size_t slot = (size_t)event.track * 16 * 128 +
+         ((event[0] & 0x0f) << 7) + (event[1] & 0x7f);
+
+   if (noteon) {
+      if (slot >= activeTop.size()) {
+         activeTop.resize(((size_t)event.track + 1) * 16 * 128, -1);
+      }
+      int index = append(event);
+      activeBelow.resize(index + 1);
+      activeBelow[index] = activeTop[slot];
+      activeTop[slot] = index;
+      return index;
+   }
+
+   if ((slot >= activeTop.size()) || (activeTop[slot] < 0)) {
+      return -1;
+   }
+   int index = activeTop[slot];
+   activeTop[slot] = activeBelow[index];
+   duration[index] = event.tick - tick[index];
+   durationSeconds[index] = event.seconds - seconds[index];
+   return index;
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////
+//
+// private functions
+//
+
+
+//////////////////////////////
+//
+// NoteTable::permute -- Reorder a column so that entry i is the old
+//    entry order[i].
+//
+
+template <class TYPE>
+void NoteTable::permute(vector<TYPE>& column, const vector<int>& order) {
+   vector<TYPE> sorted(order.size());
+   for (int i=0; i<(int)order.size(); i++) {
+      sorted[i] = column[order[i]];
+   }
+   column.swap(sorted);
+}
+
+
+
@@ -0,0 +1,64 @@
+//
+// Filename:      midifile/include/NoteTable.h
+// Syntax:        C++11
+// vim:           ts=3 expandtab
+//
+// Description:   Column-wise (structure of arrays) table of notes.  Each
+//                row is one note-on and its note-off; each property of
+//                the notes is stored in its own contiguous array so that
+//                analysis loops only touch the columns which they need.
+//                Note-ons without a note-off are stored with a duration
+//                of zero.  A table can be filled from a MidiFile (see
+//                MidiFile::getNoteTable()) or one event at a time from a
+//                time-ordered stream such as MidiStreamReader::next().
+//
+
+#ifndef _NOTETABLE_H_INCLUDED
+#define _NOTETABLE_H_INCLUDED
+
+#include "MidiEvent.h"
+#include <vector>
+
+using namespace std;
+
+class NoteTable {
+   public:
+                  NoteTable        (void);
+                 ~NoteTable        ();
+
+      void        clear            (void);
+      void        reserve          (int rsize);
+      int         getSize          (void);
+      int         size             (void);
+      int         append           (MidiEvent& noteon, MidiEvent& noteoff);
+      int         append           (MidiEvent& noteon);
+      void        sortByTick       (void);
+
+      // streaming sink for events in time order:
+      int         addEvent         (MidiEvent& event);
+
+      // one entry per note:
+      vector<int>     tick;          // onset time in ticks
+      vector<int>     duration;      // duration in ticks
+      vector<double>  seconds;       // onset time in seconds
+      vector<double>  durationSeconds; // duration in seconds
+      vector<uchar>   key;           // MIDI key number (0-127)
+      vector<uchar>   velocity;      // note-on attack velocity
+      vector<uchar>   channel;       // MIDI channel (0-15)
+      vector<ushort>  track;         // track of the note-on
+
+   private:
+      // open notes, one stack per track, channel and key:
+      vector<int>     activeTop;     // latest open note of each stack
+      vector<int>     activeBelow;   // next open note down the stack
+
+      template <class TYPE>
+      static void permute          (vector<TYPE>& column,
+                                    const vector<int>& order);
+};
+
+
+#endif /* _NOTETABLE_H_INCLUDED */
+
+
+
@@ -0,0 +1,153 @@
+/**
+ * File: audiooutput.cpp
+ * ---------------------
+ * Pulls synthesizer audio through
+ * an OpenFrameworks sound stream
+ * with a configurable period size.
+ */
+
+#include "audiooutput.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+using namespace std;
+
+/**
+ * Constructor: AudioOutput
+ * ------------------------
+ * Starts with no stream open.
+ */
+AudioOutput::AudioOutput()
+  : synth(NULL), running(false), numBuffers(0),
+    requestedBufferSize(0), deviceBufferSize(0) {}
+
+/**
+ * Destructor: AudioOutput
+ * -----------------------
+ * Closes the stream before the
+ * synthesizer can go away.
+ */
+AudioOutput::~AudioOutput() {
+  stop();
+}
+
+/**
+ * Function: start
+ * ---------------
+ * Opens a stereo output stream whose callback
+ * renders each period through synthesize, so
+ * the period size sets the key-to-sound delay.
+ */
+bool AudioOutput::start(Synthesizer* next, int bufferSize, int count) {
+  stop();
+  if (next == NULL) return false;
+
+  // bound the period and queue depth
+  bufferSize = max(16, min(bufferSize, 8192));
+  count = max(1, min(count, 16));
+
+  synth = next;
+  numBuffers = count;
+  requestedBufferSize = bufferSize;
+  deviceBufferSize = bufferSize;
+  // allocated up front for the callback
+  scratch.assign(2 * 8192, 0.0f);
+
+  stream.setOutput(this);
+  running = stream.setup(2, 0, synth -> getSampleRate(), bufferSize, count);
+  if (!running) cerr << "Cannot open sound stream." << endl;
+  return running;
+}
+
+/**
+ * Function: stop
+ * --------------
+ * Closes the stream; no callback
+ * runs once this returns.
+ */
+void AudioOutput::stop() {
+  if (running) stream.close();
+  running = false;
+}
+
+/**
+ * Function: configure
+ * -------------------
+ * Reopens the stream with a new period
+ * size and count, trading CPU time for
+ * output latency on this machine. Sizes
+ * the open stream already has are kept
+ * rather than reopened [no dropout].
+ */
+bool AudioOutput::configure(int bufferSize, int count) {
+  if (synth == NULL) return false;
+  bufferSize = max(16, min(bufferSize, 8192));
+  count = max(1, min(count, 16));
+  if (running && bufferSize == requestedBufferSize && count == numBuffers)
+    return true;
+  return start(synth, bufferSize, count);
+}
+
+/**
+ * Function: getBufferSize
+ * -----------------------
+ * Frames per period, as used
+ * by the device [may round].
+ */
+int AudioOutput::getBufferSize() {
+  return deviceBufferSize;
+}
+
+/**
+ * Function: getNumBuffers
+ * -----------------------
+ * Periods queued for output.
+ */
+int AudioOutput::getNumBuffers() {
+  return numBuffers;
+}
+
+/**
+ * Function: getBufferLatency
+ * --------------------------
+ * Nominal latency of the queued periods:
+ * each must play before a new note does.
+ * Driver and backend buffering come on
+ * top and are not included.
+ */
+double AudioOutput::getBufferLatency() {
+  if (!running || synth == NULL) return 0;
+  return 1000.0 * deviceBufferSize * numBuffers / synth -> getSampleRate();
+}
+
+/**
+ * Function: audioOut
+ * ------------------
+ * Called by the sound stream for each
+ * period. Renders interleaved stereo,
+ * spreading it over other layouts.
+ */
+void AudioOutput::audioOut(float* output, int bufferSize, int nChannels) {
+  deviceBufferSize = bufferSize;
+  if (nChannels == 2) {
+    if (!synth -> synthesize(output, bufferSize))
+      memset(output, 0, sizeof(float) * bufferSize * 2);
+    return;
+  }
+
+  // render in pieces the scratch space holds
+  for (int done = 0; done < bufferSize; ) {
+    int count = min(bufferSize - done, (int) scratch.size() / 2);
+    if (!synth -> synthesize(scratch.data(), count))
+      fill(scratch.begin(), scratch.begin() + 2 * count, 0.0f);
+
+    for (int i = 0; i < count; i += 1) {
+      float* frame = output + (done + i) * nChannels;
+      if (nChannels == 1) frame[0] = 0.5f * (scratch[2 * i] + scratch[2 * i + 1]);
+      else for (int c = 0; c < nChannels; c += 1)
+        frame[c] = c < 2 ? scratch[2 * i + c] : 0.0f;
+    }
+
+    done += count;
+  }
+}
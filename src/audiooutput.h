@@ -0,0 +1,56 @@
+/**
+ * File: audiooutput.h
+ * ---------------------
+ * Pulls synthesizer audio through
+ * an OpenFrameworks sound stream
+ * with a configurable period size.
+ */
+
+#ifndef AUDIOOUTPUT_H
+#define AUDIOOUTPUT_H
+
+#include <atomic>
+#include <vector>
+#include "ofMain.h"
+#include "synthesizer.h"
+using namespace std;
+
+// plays a synthesizer set up without
+// a FluidSynth driver [live = false]
+class AudioOutput : public ofBaseSoundOutput {
+  public:
+    AudioOutput();
+    ~AudioOutput();
+
+    // open the stream at the rate of the synth with
+    // periods of bufferSize frames, numBuffers deep
+    bool start(Synthesizer* synth, int bufferSize, int numBuffers);
+    void stop();
+    // reopen with new sizes [main thread]
+    bool configure(int bufferSize, int numBuffers);
+
+    int getBufferSize();
+    int getNumBuffers();
+    // nominal queued output in milliseconds,
+    // not counting driver buffering
+    double getBufferLatency();
+
+    // sound stream callback
+    void audioOut(float* output, int bufferSize, int nChannels);
+
+  private:
+    ofSoundStream stream;
+    Synthesizer* synth;
+    bool running;
+    int numBuffers;
+    // period passed to the stream setup
+    int requestedBufferSize;
+
+    // period the device actually asked for
+    atomic<int> deviceBufferSize;
+    // stereo frames for other channel counts
+    vector<float> scratch;
+};
+
+// guard
+#endif
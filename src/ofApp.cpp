@@ -11,7 +11,6 @@
 #include <sstream>
 #include <math.h>
 #include <dirent.h>
-#include "MIDI/MidiFile.h"
 
 using namespace ofxCv;
 using namespace cv;
@@ -43,74 +42,17 @@ bool getMIDIFiles(vector<string>& list, string dirName) {
 }
 
 /**
- * Function: buildSongVector
+ * Function: getChordPitches
  * -------------------------
- * Builds a vector of vectors representing
- * all of the notes in a song. Each inner
- * vector represents notes played at a
- * particular time together.
+ * Copies the pitches of a song chord into
+ * a caller's array of Synthesizer::CHORD_KEYS
+ * entries, so key presses do not allocate.
  */
-void buildSongVector(vector<vector<Note>>& song, vector<char>& songKeys,
-  vector<Note>& topNotes, string fileName) {
-  MidiFile songMIDI; // from Midifile library
-  songMIDI.read(fileName);
-
-  songMIDI.linkNotePairs();
-  songMIDI.doTimeAnalysis();
-  songMIDI.joinTracks();
-
-  MidiEvent* event;
-  int simulIndex = -1;
-  song.clear(); // empty old song
-  int deltaTick = -1;
-
-  // iterate through list of note on events and add them to song
-  for (int evIdx = 0; evIdx < songMIDI[0].size(); evIdx += 1) {
-    event = &songMIDI[0][evIdx];
-    if (!event -> isNoteOn()) continue;
-
-    if (event -> tick != deltaTick) {
-      deltaTick = event -> tick;
-      song.push_back(vector<Note>());
-      simulIndex += 1;
-    }
-
-    Note newNote;
-    newNote.note = (int) (*event)[1];
-    newNote.duration = event -> getDurationInSeconds();
-    song[simulIndex].push_back(newNote);
-  }
-
-  if (song.size() == 0) return; // empty
-  string hardKeys("fghj"); // six notes guitar hero style
-  Note lastNote = *max_element(song[0].begin(), song[0].end());
-  int lastKeyIndex = 3; // corresponds to j
-  songKeys.push_back(hardKeys[lastKeyIndex]);
-  topNotes.push_back(lastNote);
-
-  // determine hard mode key mappings [jank]
-  for (int i = 1; i < song.size(); i += 1) {
-    Note currNote = *max_element(song[i].begin(), song[i].end());
-    int diff = currNote.note - lastNote.note; // determines key interval
-
-    int nextKeyIndex;
-    if (diff == 0) nextKeyIndex = lastKeyIndex; // same note
-    else if (diff > 0 && diff < 3) nextKeyIndex = (lastKeyIndex + 1) % hardKeys.size();
-    else if (diff > 2 && diff < 5) nextKeyIndex = (lastKeyIndex + 2) % hardKeys.size();
-    else if (diff < 0 && diff > -3) nextKeyIndex = (lastKeyIndex - 1) % hardKeys.size();
-    else if (diff < -2 && diff > -5) nextKeyIndex = (lastKeyIndex - 2) % hardKeys.size();
-    else if (diff > 4) nextKeyIndex = (lastKeyIndex + 3) % hardKeys.size();
-    else nextKeyIndex = (lastKeyIndex - 3) % hardKeys.size();
-
-    // normalize negative mods to positive before append
-    if (nextKeyIndex < 0) nextKeyIndex += hardKeys.size();
-    songKeys.push_back(hardKeys[nextKeyIndex]);
-    topNotes.push_back(currNote);
-
-    // update last values
-    lastNote = currNote;
-    lastKeyIndex = nextKeyIndex;
-  }
+int getChordPitches(const vector<Note>& notes, int* pitches) {
+  int count = 0, limit = Synthesizer::CHORD_KEYS;
+  for (size_t i = 0; i < notes.size() && count < limit; i += 1)
+    pitches[count++] = notes[i].note;
+  return count;
 }
 
 /**
@@ -129,6 +71,9 @@ void ofApp::setup() {
   if (getMIDIFiles(filesMIDI, "data/MIDI"))
     loadedMIDI = true; // successful load
 
+  // parse every song in the background
+  library.start(filesMIDI);
+
   // get UI listing variables
   scales = mapper.getScales();
   keys = mapper.getKeys();
@@ -136,9 +81,13 @@ void ofApp::setup() {
 
   // initialize synthesizer
   synth = new Synthesizer();
-  synth -> init(44100, 256, true);
+  synth -> init(44100, 256, false);
   synth -> load("data/primary.sf2");
   synth -> setInstrument(1, 21);
+  synth -> setSequencer(&sequencer);
+
+  // the sound stream pulls audio from the synth
+  output.start(synth, outputBufferSize, outputNumBuffers);
 
   // initialize graphics
   ofBackground(190,30,45);
@@ -195,6 +144,24 @@ void ofApp::setup() {
   fulscr = false;
 }
 
+/**
+ * Function: exit
+ * --------------
+ * Closes the sound stream before members are
+ * destroyed: its callback renders the synth,
+ * which dispatches the sequencer's events.
+ * Then detaches the sequencer and frees the
+ * synth, stopping any driver thread of its own.
+ */
+void ofApp::exit() {
+  output.stop();
+  if (synth == NULL) return;
+
+  synth -> setSequencer(NULL);
+  delete synth;
+  synth = NULL;
+}
+
 /**
  * Function: update
  * ----------------
@@ -203,6 +170,9 @@ void ofApp::setup() {
  * smoothing on flow values.
  */
 void ofApp::update() {
+  // song ended during auto play
+  if (autoPlay && sequencer.isFinished()) stopAutoPlay();
+
   // get new frame
   camera.update();
 
@@ -244,7 +214,8 @@ void ofApp::update() {
     xVelSm = xVelSmNew;
     yVelSm = yVelSmNew;
 
-    if (bend) // pitch bend with touchpad
+    // the song owns channel 1 during auto play
+    if (bend && !autoPlay) // pitch bend with touchpad
       synth -> pitchBend(1, -yVelSm < -1.0 
         ? -1.0 : (-yVelSm > 1.0 ? 1.0 : -yVelSm));
 
@@ -297,7 +268,7 @@ void ofApp::update() {
 
     // update the synth volume by an increment in direction of tilt velocity
     synthVol += diffIncrement > maxIncrement ? maxIncrement : diffIncrement;
-    synth -> controlChange(1, 7, tiltSmooth > 1.5 ? synthVol : 0);
+    if (!autoPlay) synth -> controlChange(1, 7, tiltSmooth > 1.5 ? synthVol : 0);
     sounding = tiltSmooth > 1.5;
   }
 
@@ -539,10 +510,9 @@ void ofApp::keyPressed(int key) {
         return; // wrong key played
 
       keyPosMap[key] = songPosition; // turn off shit by the key
-      for (int i = 0; i < song[songPosition].size(); i += 1) {
-        int note = song[songPosition][i].note;
-        synth -> noteOn(1, note, 127);
-      }
+      int chord[Synthesizer::CHORD_KEYS]; // start all chord notes together
+      int numPitches = getChordPitches(song[songPosition], chord);
+      synth -> chordOn(1, chord, numPitches, 127);
 
       // colorings
       if (hardMode) {
@@ -607,7 +577,7 @@ void ofApp::keyPressed(int key) {
     hardMode = !hardMode;
 
   // toggle play through
-  if (key == '=') {
+  if (key == '=' && !autoPlay) {
     // toggle off
     if (playThrough) {
       playThrough = false;
@@ -623,8 +593,13 @@ void ofApp::keyPressed(int key) {
     playThrough = true;
     songPosition = 0;
 
-    // calculate note lengths and positions
-    buildSongVector(song, songKeys, topNotes, filesMIDI[filesIndex]);
+    // note lengths and positions are built by
+    // the library [blocks only if not yet loaded]
+    Song loaded;
+    library.get(filesIndex, loaded);
+    song.swap(loaded.chords);
+    topNotes.swap(loaded.topNotes);
+    songKeys.swap(loaded.keys);
 
     // bad song passed
     if (!song.size()) {
@@ -652,15 +627,45 @@ void ofApp::keyPressed(int key) {
   // change mode [keyboard layout schematic, e.g. inc by rows] with '
   if (key == '\'') mapper.setModeIndex(modeIndex = ++modeIndex % modes.size());
 
+  // toggle auto play of the selected song when not in play through mode
+  if (key == '7' && !playThrough) {
+    if (autoPlay) stopAutoPlay();
+    else if (loadedMIDI) {
+      // only load while detached from rendering
+      synth -> setSequencer(NULL);
+      bool loaded = sequencer.load(filesMIDI[filesIndex], synth -> getSampleRate());
+      synth -> setSequencer(&sequencer);
+
+      if (loaded) {
+        sequencer.play();
+        autoPlay = true;
+      }
+    }
+  }
+
+  // skip back or ahead ten seconds during auto play
+  if (key == '5' && autoPlay) sequencer.seek(sequencer.getSeconds() - 10);
+  if (key == '6' && autoPlay) sequencer.seek(sequencer.getSeconds() + 10);
+
   // change the selected song in directory with - when not in playthrough mode
-  if (key == '-' && !playThrough) filesIndex = ++filesIndex % filesMIDI.size();
+  if (key == '-' && !playThrough && !autoPlay) filesIndex = ++filesIndex % filesMIDI.size();
 
   // press 9 for skeumorphism
   if (key == '9') skeumorph =! skeumorph;
 
   // press 8 for toggling pitch bend
   if (key == '8') bend = !bend;
-  if (!bend) synth -> pitchBend(1, 0);
+  if (!bend && !autoPlay) synth -> pitchBend(1, 0);
+
+  // trade CPU time for latency: period size and count
+  int lastBufferSize = outputBufferSize;
+  int lastNumBuffers = outputNumBuffers;
+  if (key == '1' && outputBufferSize > 32) outputBufferSize /= 2;
+  if (key == '2' && outputBufferSize < 4096) outputBufferSize *= 2;
+  if (key == '3' && outputNumBuffers > 2) outputNumBuffers -= 1;
+  if (key == '4' && outputNumBuffers < 8) outputNumBuffers += 1;
+  if (outputBufferSize != lastBufferSize || outputNumBuffers != lastNumBuffers)
+    output.configure(outputBufferSize, outputNumBuffers);
 }
 
 /**
@@ -690,10 +695,9 @@ void ofApp::keyReleased(int key) {
       }
 
       // turn off all notes in the time vector for the given key
-      for (int i = 0; i < song[keyPosMap[key]].size(); i += 1) {
-        int note = song[keyPosMap[key]][i].note;
-        synth -> noteOff(1, note);
-      }
+      int chord[Synthesizer::CHORD_KEYS];
+      int numPitches = getChordPitches(song[keyPosMap[key]], chord);
+      synth -> chordOff(1, chord, numPitches);
 
       // remove the key from map
       pressed.erase(key);
@@ -711,6 +715,25 @@ void ofApp::keyReleased(int key) {
   }
 }
 
+/**
+ * Function: stopAutoPlay
+ * ----------------------
+ * Stops the song and gives the
+ * accordion back its instrument.
+ * The synth is reset so that no
+ * sustain, controller or bend of
+ * the song lingers on its channels.
+ */
+void ofApp::stopAutoPlay() {
+  sequencer.pause();
+  sequencer.rewind();
+  synth -> setSequencer(NULL); // releases song notes
+  synth -> reset();
+  synth -> setSequencer(&sequencer);
+  synth -> setInstrument(1, 21);
+  autoPlay = false;
+}
+
 /**
  * Function: drawLeder
  * --------------------
@@ -806,10 +829,13 @@ void ofApp::drawKeys(){
                      string("Current Scale: ") + scales[scaleIndex] + " (])\n" +
                      string("Current Key: ") + keys[keyIndex] + " ([)\n" +
                      string("Current Mode: ") + modes[modeIndex] + " (')\n" +
-                     string("Pitch Bend: ") + (bend ? string("Enabled") : string("Disabled")) + " (8)\n\n" +
+                     string("Pitch Bend: ") + (bend ? string("Enabled") : string("Disabled")) + " (8)\n" +
+                     string("Audio Output: ") + ofToString(output.getBufferSize()) + " x " + ofToString(output.getNumBuffers()) +
+                     string(" Frames, ") + ofToString(output.getBufferLatency(), 1) + " ms Buffered (1 to 4)\n\n" +
                      string("Selected Song: ") + filesMIDI[filesIndex].substr(10, filesMIDI[filesIndex].size() - 14) +
                      string(" (-)\nPlay Through Mode: ") + (playThrough ? string("Running") : string("Stopped")) +
-                     string(" (=)\nHard Mode: ") + (hardMode ? string("On") : string("Off")) + " (0)", 10, 20, 2);
+                     string(" (=)\nAuto Play: ") + (autoPlay ? string("Running") : string("Stopped")) +
+                     string(" (7, Seek With 5 and 6)\nHard Mode: ") + (hardMode ? string("On") : string("Off")) + " (0)", 10, 20, 2);
 
   if (!hardMode) {
     string topChars = "qwertyuiop";
@@ -14,25 +14,9 @@
 #include "ofxCv.h"
 #include "mapper.h"
 #include "synthesizer.h"
-
-/**
- * Type: Note
- * ----------
- * A simple struct to hold
- * notes derived from MIDI.
- */
-struct Note {
-  int note;
-  // in seconds
-  double duration;
-
-  // comparison functions for algorithms
-  bool operator>(const Note& n) const { return note > n.note; }
-  bool operator>=(const Note& n) const { return note >= n.note; }
-  bool operator==(const Note& n) const { return note == n.note; }
-  bool operator<=(const Note& n) const { return note <= n.note; }
-  bool operator<(const Note& n) const { return note < n.note; }
-};
+#include "audiooutput.h"
+#include "sequencer.h"
+#include "song.h"
 
 // master OpenFrameworks runner
 class ofApp : public ofBaseApp {
@@ -40,6 +24,7 @@ class ofApp : public ofBaseApp {
     void setup();
     void update();
     void draw();
+    void exit();
 
     // some usual boilerplate
     void keyPressed(int key);
@@ -51,6 +36,11 @@ class ofApp : public ofBaseApp {
     Synthesizer* synth = NULL;
     int synthVol = 0;
 
+    // pulls synth audio [latency set with 1 to 4]
+    AudioOutput output;
+    int outputBufferSize = 256;
+    int outputNumBuffers = 4;
+
     // initialize camera
     ofVideoGrabber camera;
 
@@ -70,6 +60,7 @@ class ofApp : public ofBaseApp {
 
     // play through files
     vector<string> filesMIDI;
+    SongLibrary library;
     bool loadedMIDI = false;
     bool playThrough = false;
     bool hardMode = false;
@@ -77,6 +68,11 @@ class ofApp : public ofBaseApp {
     int songPosition = 0;
     map<int, int> keyPosMap;
 
+    // auto play of the selected song
+    Sequencer sequencer;
+    bool autoPlay = false;
+    void stopAutoPlay();
+
     // built for every file
     vector<vector<Note>> song;
     vector<Note> topNotes;
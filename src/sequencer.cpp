@@ -0,0 +1,393 @@
+/**
+ * File: sequencer.cpp
+ * ---------------------
+ * Plays the channel messages of a
+ * MIDI file through the synthesizer,
+ * timed by the audio render position.
+ */
+
+#include "sequencer.h"
+#include "synthesizer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+using namespace std;
+
+// events between channel state snapshots
+static const size_t SNAPSHOT_EVENTS = 1024;
+
+/**
+ * Function: reset
+ * ---------------
+ * General MIDI power-on state.
+ */
+void ChannelState::reset() {
+  program = 0;
+  volume = 100;
+  expression = 127;
+  sustain = 0;
+  bend = 8192;
+  memset(notes, 0, sizeof(notes));
+}
+
+/**
+ * Function: apply
+ * ---------------
+ * Updates the state with one
+ * event on this channel.
+ */
+void ChannelState::apply(const SequencerEvent& event) {
+  switch (event.status & 0xf0) {
+    case 0x80: notes[event.dataOne] = 0; break;
+    case 0x90: notes[event.dataOne] = event.dataTwo; break;
+    case 0xc0: program = event.dataOne; break;
+    case 0xe0: bend = event.dataOne | (event.dataTwo << 7); break;
+    case 0xb0:
+      if (event.dataOne == 7) volume = event.dataTwo;
+      else if (event.dataOne == 11) expression = event.dataTwo;
+      else if (event.dataOne == 64) sustain = event.dataTwo;
+      break;
+  }
+}
+
+/**
+ * Function: build
+ * ---------------
+ * Records the state of every channel before
+ * each run of SNAPSHOT_EVENTS events, so a
+ * seek replays at most that many events.
+ * Every index up to the event count has a
+ * snapshot at or before it.
+ */
+void SeekIndex::build(const vector<SequencerEvent>& events) {
+  ChannelState states[16];
+  for (int i = 0; i < 16; i += 1) {
+    states[i].reset();
+    used[i] = false;
+  }
+
+  snapshots.clear();
+  snapshots.reserve((events.size() / SNAPSHOT_EVENTS + 1) * 16);
+  for (size_t i = 0; i < events.size(); i += 1) {
+    if (i % SNAPSHOT_EVENTS == 0)
+      snapshots.insert(snapshots.end(), states, states + 16);
+
+    int channel = events[i].status & 0x0f;
+    states[channel].apply(events[i]);
+    used[channel] = true;
+  }
+
+  // state after the last event, for seeks past
+  // the end when it closes a run exactly
+  if (events.size() && events.size() % SNAPSHOT_EVENTS == 0)
+    snapshots.insert(snapshots.end(), states, states + 16);
+}
+
+/**
+ * Function: getState
+ * ------------------
+ * Fills sixteen channel states with the state
+ * before the given event: the nearest snapshot
+ * plus a replay of the events after it.
+ */
+void SeekIndex::getState(const vector<SequencerEvent>& events,
+    size_t index, ChannelState* states) {
+  size_t snapshot = index / SNAPSHOT_EVENTS;
+  if (snapshot * 16 >= snapshots.size()) {
+    for (int i = 0; i < 16; i += 1) states[i].reset();
+    return; // no events
+  }
+
+  copy(snapshots.begin() + snapshot * 16,
+    snapshots.begin() + snapshot * 16 + 16, states);
+  for (size_t i = snapshot * SNAPSHOT_EVENTS; i < index; i += 1)
+    states[events[i].status & 0x0f].apply(events[i]);
+}
+
+/**
+ * Function: isUsed
+ * ----------------
+ * True if the song has events
+ * on the given channel.
+ */
+bool SeekIndex::isUsed(int channel) {
+  return used[channel];
+}
+
+/**
+ * Constructor: Sequencer
+ * ----------------------
+ * Starts empty and paused.
+ */
+Sequencer::Sequencer()
+  : sampleRate(44100), endFrame(0), nextEvent(0), rendering(false),
+    chasing(true), playing(false), pendingSeek(-1), position(0) {
+  memset(sounding, 0, sizeof(sounding));
+  index.build(events);
+}
+
+/**
+ * Function: load
+ * --------------
+ * Reads a MIDI file and keeps its channel
+ * messages. Must not be called while the
+ * sequencer is attached to a synthesizer.
+ */
+bool Sequencer::load(const string& fileName, int rate) {
+  MidiFile midi;
+  if (!midi.readMapped(fileName)) return false;
+  return load(midi, rate);
+}
+
+/**
+ * Function: load
+ * --------------
+ * Joins the tracks of the file, times them,
+ * and converts note, control, program and
+ * bend messages to frames at the given rate.
+ */
+bool Sequencer::load(MidiFile& midi, int rate) {
+  events.clear();
+  sampleRate = rate > 0 ? rate : 44100;
+  endFrame = 0;
+
+  midi.absoluteTicks();
+  midi.joinTracks();
+  midi.doTimeAnalysis();
+
+  MidiEventList& list = midi[0];
+  events.reserve(list.size());
+  for (int i = 0; i < list.size(); i += 1) {
+    MidiEvent& event = list[i];
+    if (event.size() < 2) continue;
+
+    int command = event[0] & 0xf0;
+    if (command != 0x80 && command != 0x90 && command != 0xb0 &&
+        command != 0xc0 && command != 0xe0) continue;
+    if (command != 0xc0 && event.size() < 3) continue;
+
+    SequencerEvent scheduled;
+    scheduled.frame = llround(event.seconds * sampleRate);
+    scheduled.status = event[0];
+    scheduled.dataOne = event[1] & 0x7f;
+    scheduled.dataTwo = command == 0xc0 ? 0 : event[2] & 0x7f;
+    events.push_back(scheduled);
+  }
+
+  if (events.size()) endFrame = events.back().frame;
+  index.build(events);
+  nextEvent = 0;
+  chasing = true;
+  position = 0;
+  pendingSeek = -1;
+  return events.size() > 0;
+}
+
+/**
+ * Function: play
+ * --------------
+ * Starts or resumes playback at the next
+ * block rendered by the synthesizer.
+ */
+void Sequencer::play() {
+  playing = true;
+}
+
+/**
+ * Function: pause
+ * ---------------
+ * Stops playback; sounding notes are
+ * released by the next rendered block.
+ */
+void Sequencer::pause() {
+  playing = false;
+}
+
+/**
+ * Function: rewind
+ * ----------------
+ * Returns to the start of the song.
+ */
+void Sequencer::rewind() {
+  pendingSeek = 0;
+}
+
+/**
+ * Function: seek
+ * --------------
+ * Moves to a time in the song. The
+ * channel state at that time is sent
+ * to the synth before playing on.
+ */
+void Sequencer::seek(double seconds) {
+  pendingSeek = seconds > 0 ? llround(seconds * sampleRate) : 0;
+}
+
+/**
+ * Function: isPlaying
+ * -------------------
+ * True between play and pause.
+ */
+bool Sequencer::isPlaying() {
+  return playing;
+}
+
+/**
+ * Function: isFinished
+ * --------------------
+ * True once the last event has played.
+ */
+bool Sequencer::isFinished() {
+  return position > endFrame;
+}
+
+/**
+ * Function: getSeconds
+ * --------------------
+ * Song time of the audio rendered so far.
+ */
+double Sequencer::getSeconds() {
+  return (double) position / sampleRate;
+}
+
+/**
+ * Function: dispatch
+ * ------------------
+ * Called by the render thread before each slice
+ * of audio. Applies every event due at the current
+ * frame and returns the number of frames to render
+ * before the next event is due. FluidSynth still
+ * only takes events at its internal 64-frame block
+ * boundaries, so an event sounds within about 64
+ * frames of its time rather than on the exact
+ * frame, whatever the output period size.
+ */
+int Sequencer::dispatch(Synthesizer* synth, int numFrames) {
+  long long seek = pendingSeek.exchange(-1);
+  if (seek >= 0) {
+    silence(synth);
+    SequencerEvent target;
+    target.frame = seek;
+    nextEvent = lower_bound(events.begin(), events.end(), target,
+      [](const SequencerEvent& a, const SequencerEvent& b) {
+        return a.frame < b.frame;
+      }) - events.begin();
+    position = seek;
+    chasing = true;
+  }
+
+  if (!playing) {
+    if (rendering) {
+      silence(synth);
+      chasing = true; // restore when resumed
+    }
+    rendering = false;
+    return numFrames;
+  }
+
+  // after a seek or pause [and at the start]
+  if (chasing) chase(synth);
+  chasing = false;
+
+  rendering = true;
+  long long now = position.load(memory_order_relaxed);
+  while (nextEvent < events.size() && events[nextEvent].frame <= now)
+    apply(synth, events[nextEvent++]);
+
+  if (nextEvent >= events.size()) return numFrames;
+  long long until = events[nextEvent].frame - now;
+  return until < numFrames ? (int) until : numFrames;
+}
+
+/**
+ * Function: advance
+ * -----------------
+ * Moves the song position past the frames
+ * just rendered, if they were played.
+ */
+void Sequencer::advance(int numFrames) {
+  if (rendering) position.fetch_add(numFrames, memory_order_relaxed);
+}
+
+/**
+ * Function: apply
+ * ---------------
+ * Sends one message to the synth and
+ * tracks which notes are sounding.
+ */
+void Sequencer::apply(Synthesizer* synth, const SequencerEvent& event) {
+  int channel = event.status & 0x0f;
+  switch (event.status & 0xf0) {
+    case 0x90:
+      if (event.dataTwo > 0) {
+        synth -> apply(SynthCommand::NOTE_ON, channel, event.dataOne, event.dataTwo);
+        sounding[channel][event.dataOne] = true;
+        break;
+      }
+      // velocity zero is a note off
+      // fall through
+    case 0x80:
+      synth -> apply(SynthCommand::NOTE_OFF, channel, event.dataOne, 0);
+      sounding[channel][event.dataOne] = false;
+      break;
+    case 0xb0:
+      synth -> apply(SynthCommand::CONTROL, channel, event.dataOne, event.dataTwo);
+      break;
+    case 0xc0:
+      synth -> apply(SynthCommand::PROGRAM, channel, event.dataOne, 0);
+      break;
+    case 0xe0:
+      synth -> apply(SynthCommand::BEND, channel, event.dataOne | (event.dataTwo << 7), 0);
+      break;
+  }
+}
+
+/**
+ * Function: chase
+ * ---------------
+ * Sends the state of each channel the song
+ * uses at the current position: program,
+ * volume, expression, sustain, bend and the
+ * notes that would be sounding.
+ */
+void Sequencer::chase(Synthesizer* synth) {
+  ChannelState states[16];
+  index.getState(events, nextEvent, states);
+
+  for (int channel = 0; channel < 16; channel += 1) {
+    if (!index.isUsed(channel)) continue;
+    ChannelState& state = states[channel];
+
+    synth -> apply(SynthCommand::PROGRAM, channel, state.program, 0);
+    synth -> apply(SynthCommand::CONTROL, channel, 7, state.volume);
+    synth -> apply(SynthCommand::CONTROL, channel, 11, state.expression);
+    synth -> apply(SynthCommand::CONTROL, channel, 64, state.sustain);
+    synth -> apply(SynthCommand::BEND, channel, state.bend, 0);
+
+    for (int key = 0; key < 128; key += 1) {
+      if (!state.notes[key]) continue;
+      synth -> apply(SynthCommand::NOTE_ON, channel, key, state.notes[key]);
+      sounding[channel][key] = true;
+    }
+  }
+}
+
+/**
+ * Function: silence
+ * -----------------
+ * Releases the notes started by the song and
+ * lifts the sustain pedal, so held notes do not
+ * ring on [chase restores it]. Called by the
+ * render thread, or the synth when detaching.
+ */
+void Sequencer::silence(Synthesizer* synth) {
+  for (int channel = 0; channel < 16; channel += 1) {
+    if (index.isUsed(channel))
+      synth -> apply(SynthCommand::CONTROL, channel, 64, 0);
+    for (int key = 0; key < 128; key += 1) {
+      if (!sounding[channel][key]) continue;
+      synth -> apply(SynthCommand::NOTE_OFF, channel, key, 0);
+      sounding[channel][key] = false;
+    }
+  }
+}
@@ -0,0 +1,117 @@
+/**
+ * File: sequencer.h
+ * ---------------------
+ * Plays the channel messages of a
+ * MIDI file through the synthesizer,
+ * timed by the audio render position.
+ */
+
+#ifndef SEQUENCER_H
+#define SEQUENCER_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include "MIDI/MidiFile.h"
+using namespace std;
+
+class Synthesizer;
+
+/**
+ * Type: SequencerEvent
+ * --------------------
+ * A channel message due at a
+ * given sample frame of the song.
+ */
+struct SequencerEvent {
+  long long frame;
+  unsigned char status;
+  unsigned char dataOne;
+  unsigned char dataTwo;
+};
+
+/**
+ * Type: ChannelState
+ * ------------------
+ * Controller values and sounding
+ * notes of one MIDI channel, as
+ * chased when seeking in a song.
+ */
+struct ChannelState {
+  unsigned char program;
+  unsigned char volume; // CC7
+  unsigned char expression; // CC11
+  unsigned char sustain; // CC64
+  unsigned short bend;
+  // velocity of each sounding note
+  unsigned char notes[128];
+
+  void reset();
+  void apply(const SequencerEvent& event);
+};
+
+// periodic snapshots of channel state
+class SeekIndex {
+  public:
+    void build(const vector<SequencerEvent>& events);
+    // state of all channels before an event
+    void getState(const vector<SequencerEvent>& events,
+      size_t index, ChannelState* states);
+    bool isUsed(int channel);
+
+  private:
+    // sixteen channels per snapshot
+    vector<ChannelState> snapshots;
+    bool used[16];
+};
+
+// schedules song events by audio frame
+class Sequencer {
+  public:
+    Sequencer();
+
+    // join and time a MIDI file and keep its
+    // channel messages [only while detached]
+    bool load(const string& fileName, int rate);
+    bool load(MidiFile& midi, int rate);
+
+    // transport [safe from any thread]
+    void play();
+    void pause();
+    void rewind();
+    void seek(double seconds);
+    bool isPlaying();
+    bool isFinished();
+    double getSeconds();
+
+    // render thread: apply events due now and
+    // return how many frames to render before
+    // the next one, then advance by that many
+    int dispatch(Synthesizer* synth, int numFrames);
+    void advance(int numFrames);
+    // release song notes and sustain [render
+    // thread or detach]
+    void silence(Synthesizer* synth);
+
+  private:
+    void apply(Synthesizer* synth, const SequencerEvent& event);
+    void chase(Synthesizer* synth);
+
+    vector<SequencerEvent> events;
+    SeekIndex index;
+    int sampleRate;
+    long long endFrame;
+
+    // owned by the render thread
+    size_t nextEvent;
+    bool rendering;
+    bool chasing; // restore state before playing
+    bool sounding[16][128];
+
+    atomic<bool> playing;
+    atomic<long long> pendingSeek; // -1 if none
+    atomic<long long> position; // frames played
+};
+
+// guard
+#endif
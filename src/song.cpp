@@ -0,0 +1,471 @@
+/**
+ * File: song.cpp
+ * ---------------------
+ * Play-through songs derived from MIDI
+ * files, with a compiled binary cache
+ * kept next to each file.
+ */
+
+#include "song.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "MIDI/MappedFile.h"
+#include "MIDI/MidiStreamReader.h"
+#include "MIDI/NoteTable.h"
+using namespace std;
+
+// bump when the layout or analysis changes
+static const uint32_t CACHE_VERSION = 2;
+
+/**
+ * Type: CacheHeader
+ * -----------------
+ * Start of a compiled song file. It is followed
+ * by the chord notes, the top notes, the chord
+ * offsets into the notes, and the key chart.
+ */
+struct CacheHeader {
+  char magic[4]; // "SONG"
+  uint32_t version;
+  uint64_t midiSize;
+  int64_t midiTime; // modification time
+  uint64_t midiHash; // FNV-1a of MIDI bytes
+  uint32_t chordCount;
+  uint32_t noteCount;
+};
+
+// fixed layout of a cached note
+struct CacheNote {
+  double duration;
+  int32_t note;
+  int32_t padding;
+};
+
+/**
+ * Function: getFileStamp
+ * ----------------------
+ * Gets the size and modification
+ * time of a file for validation.
+ */
+static bool getFileStamp(const string& fileName, uint64_t& size, int64_t& time) {
+  struct stat info;
+  if (stat(fileName.c_str(), &info) != 0) return false;
+  size = (uint64_t) info.st_size;
+  time = (int64_t) info.st_mtime;
+  return true;
+}
+
+/**
+ * Function: hashFile
+ * ------------------
+ * Hashes the contents of a file so that a
+ * touched but unchanged MIDI file keeps its
+ * cache. Returns false if unreadable.
+ */
+static bool hashFile(const string& fileName, uint64_t& hash) {
+  MappedFile file;
+  if (!file.open(fileName)) return false;
+
+  hash = 14695981039346656037ULL; // FNV-1a 64 bit
+  const uchar* data = file.data();
+  for (size_t i = 0; i < file.size(); i += 1) {
+    hash ^= data[i];
+    hash *= 1099511628211ULL;
+  }
+  return true;
+}
+
+/**
+ * Function: setCacheTime
+ * ----------------------
+ * Rewrites the modification time in the
+ * header of a cache whose MIDI file was
+ * touched, so later loads skip the hash.
+ */
+static bool setCacheTime(const string& cachePath, int64_t midiTime) {
+  fstream cache(cachePath.c_str(), ios::binary | ios::in | ios::out);
+  if (!cache.is_open()) return false;
+
+  cache.seekp(offsetof(CacheHeader, midiTime));
+  cache.write((const char*) &midiTime, sizeof(midiTime));
+  return (bool) cache;
+}
+
+/**
+ * Function: cacheSize
+ * -------------------
+ * Total bytes in a compiled song.
+ */
+static size_t cacheSize(uint32_t chordCount, uint32_t noteCount) {
+  return sizeof(CacheHeader) + sizeof(CacheNote) * (noteCount + chordCount)
+    + sizeof(uint32_t) * (chordCount + 1) + chordCount;
+}
+
+/**
+ * Function: cacheName
+ * -------------------
+ * Compiled songs are stored next to the
+ * MIDI file with an extra extension.
+ */
+string Song::cacheName(const string& fileName) {
+  return fileName + ".song";
+}
+
+/**
+ * Function: load
+ * --------------
+ * Loads a song from its compiled cache if the
+ * cache matches the MIDI file, and otherwise
+ * analyzes the MIDI and rewrites the cache.
+ */
+bool Song::load(const string& fileName) {
+  if (readCache(fileName)) return true;
+  if (!build(fileName)) return false;
+
+  writeCache(fileName); // may be read only
+  return true;
+}
+
+/**
+ * Function: build
+ * ---------------
+ * Builds a vector of vectors representing
+ * all of the notes in a song. Each inner
+ * vector represents notes played at a
+ * particular time together.
+ */
+bool Song::build(const string& fileName) {
+  chords.clear(); // empty old song
+  topNotes.clear();
+  keys.clear();
+
+  // streams events in time order
+  // without loading the whole file
+  MidiStreamReader songMIDI(fileName);
+  if (!songMIDI.status()) return false;
+
+  // one column per note property, filled
+  // in onset order as the events pass
+  NoteTable notes;
+  MidiEvent event;
+  while (songMIDI.next(event)) notes.addEvent(event);
+  if (songMIDI.hasError()) return false; // truncated
+
+  const int* ticks = notes.tick.data();
+  int noteCount = notes.size();
+
+  // count chords first so the outer vector is sized once
+  int chordCount = 0;
+  for (int i = 0; i < noteCount; i += 1)
+    if (i == 0 || ticks[i] != ticks[i - 1]) chordCount += 1;
+  chords.reserve(chordCount);
+
+  // notes starting on the same tick form a chord
+  for (int i = 0; i < noteCount; i += 1) {
+    if (i == 0 || ticks[i] != ticks[i - 1]) chords.push_back(vector<Note>());
+
+    Note newNote;
+    newNote.note = (int) notes.key[i];
+    newNote.duration = notes.durationSeconds[i];
+    chords.back().push_back(newNote);
+  }
+
+  if (chords.size() == 0) return false; // empty
+  string hardKeys("fghj"); // six notes guitar hero style
+  Note lastNote = *max_element(chords[0].begin(), chords[0].end());
+  int lastKeyIndex = 3; // corresponds to j
+  keys.push_back(hardKeys[lastKeyIndex]);
+  topNotes.push_back(lastNote);
+
+  // determine hard mode key mappings [jank]
+  for (size_t i = 1; i < chords.size(); i += 1) {
+    Note currNote = *max_element(chords[i].begin(), chords[i].end());
+    int diff = currNote.note - lastNote.note; // determines key interval
+
+    int nextKeyIndex;
+    if (diff == 0) nextKeyIndex = lastKeyIndex; // same note
+    else if (diff > 0 && diff < 3) nextKeyIndex = (lastKeyIndex + 1) % hardKeys.size();
+    else if (diff > 2 && diff < 5) nextKeyIndex = (lastKeyIndex + 2) % hardKeys.size();
+    else if (diff < 0 && diff > -3) nextKeyIndex = (lastKeyIndex - 1) % hardKeys.size();
+    else if (diff < -2 && diff > -5) nextKeyIndex = (lastKeyIndex - 2) % hardKeys.size();
+    else if (diff > 4) nextKeyIndex = (lastKeyIndex + 3) % hardKeys.size();
+    else nextKeyIndex = (lastKeyIndex - 3) % hardKeys.size();
+
+    // normalize negative mods to positive before append
+    if (nextKeyIndex < 0) nextKeyIndex += hardKeys.size();
+    keys.push_back(hardKeys[nextKeyIndex]);
+    topNotes.push_back(currNote);
+
+    // update last values
+    lastNote = currNote;
+    lastKeyIndex = nextKeyIndex;
+  }
+
+  return true;
+}
+
+/**
+ * Function: readCache
+ * -------------------
+ * Maps the compiled song into memory and copies
+ * it out if it was compiled from this MIDI file.
+ * The size and modification time are checked
+ * first; on a time mismatch the MIDI contents
+ * are hashed so that touched files still hit,
+ * and the new time is stored in the cache.
+ */
+bool Song::readCache(const string& fileName) {
+  uint64_t midiSize; int64_t midiTime;
+  if (!getFileStamp(fileName, midiSize, midiTime)) return false;
+
+  MappedFile cache;
+  if (!cache.open(cacheName(fileName))) return false;
+  if (cache.size() < sizeof(CacheHeader)) return false;
+
+  CacheHeader header;
+  memcpy(&header, cache.data(), sizeof(CacheHeader));
+  if (memcmp(header.magic, "SONG", 4) != 0) return false;
+  if (header.version != CACHE_VERSION) return false;
+  if (header.midiSize != midiSize) return false;
+  if (header.chordCount == 0) return false;
+  if (header.noteCount < header.chordCount) return false;
+  if (cache.size() != cacheSize(header.chordCount, header.noteCount)) return false;
+
+  // modified time differs but contents may not
+  bool touched = header.midiTime != midiTime;
+  if (touched) {
+    uint64_t midiHash;
+    if (!hashFile(fileName, midiHash)) return false;
+    if (midiHash != header.midiHash) return false;
+  }
+
+  // sections follow the header in order
+  const uchar* ptr = cache.data() + sizeof(CacheHeader);
+  const CacheNote* notes = (const CacheNote*) ptr;
+  ptr += sizeof(CacheNote) * header.noteCount;
+  const CacheNote* tops = (const CacheNote*) ptr;
+  ptr += sizeof(CacheNote) * header.chordCount;
+  const uint32_t* offsets = (const uint32_t*) ptr;
+  ptr += sizeof(uint32_t) * (header.chordCount + 1);
+  const char* chart = (const char*) ptr;
+
+  chords.assign(header.chordCount, vector<Note>());
+  topNotes.resize(header.chordCount);
+  keys.assign(chart, chart + header.chordCount);
+
+  for (uint32_t i = 0; i < header.chordCount; i += 1) {
+    uint32_t begin = offsets[i], end = offsets[i + 1];
+    if (begin >= end || end > header.noteCount) {
+      chords.clear(); topNotes.clear(); keys.clear();
+      return false; // corrupt
+    }
+
+    chords[i].resize(end - begin);
+    for (uint32_t j = begin; j < end; j += 1) {
+      chords[i][j - begin].note = notes[j].note;
+      chords[i][j - begin].duration = notes[j].duration;
+    }
+
+    topNotes[i].note = tops[i].note;
+    topNotes[i].duration = tops[i].duration;
+  }
+
+  // the contents matched: take the
+  // fast path on the next load
+  cache.close();
+  if (touched) setCacheTime(cacheName(fileName), midiTime); // may be read only
+  return true;
+}
+
+/**
+ * Function: writeCache
+ * --------------------
+ * Writes the compiled song next to the MIDI
+ * file. Written to a temporary name and then
+ * renamed so readers never see partial files.
+ */
+bool Song::writeCache(const string& fileName) {
+  if (chords.size() == 0) return false;
+
+  CacheHeader header;
+  memcpy(header.magic, "SONG", 4);
+  header.version = CACHE_VERSION;
+  if (!getFileStamp(fileName, header.midiSize, header.midiTime)) return false;
+  if (!hashFile(fileName, header.midiHash)) return false;
+  header.chordCount = chords.size();
+  header.noteCount = 0;
+
+  vector<uint32_t> offsets(1, 0);
+  for (size_t i = 0; i < chords.size(); i += 1) {
+    header.noteCount += chords[i].size();
+    offsets.push_back(header.noteCount);
+  }
+
+  vector<CacheNote> notes;
+  notes.reserve(header.noteCount + header.chordCount);
+  for (size_t i = 0; i < chords.size(); i += 1) {
+    for (size_t j = 0; j < chords[i].size(); j += 1) {
+      CacheNote cached = { chords[i][j].duration, chords[i][j].note, 0 };
+      notes.push_back(cached);
+    }
+  }
+
+  for (size_t i = 0; i < topNotes.size(); i += 1) {
+    CacheNote cached = { topNotes[i].duration, topNotes[i].note, 0 };
+    notes.push_back(cached);
+  }
+
+  string cache = cacheName(fileName);
+  string temp = cache + ".tmp";
+  ofstream out(temp.c_str(), ios::binary | ios::out | ios::trunc);
+  if (!out.is_open()) return false;
+
+  out.write((const char*) &header, sizeof(header));
+  out.write((const char*) notes.data(), sizeof(CacheNote) * notes.size());
+  out.write((const char*) offsets.data(), sizeof(uint32_t) * offsets.size());
+  out.write(keys.data(), keys.size());
+  out.close();
+
+  if (!out) {
+    remove(temp.c_str());
+    return false;
+  }
+
+  remove(cache.c_str()); // rename won't replace on windows
+  if (rename(temp.c_str(), cache.c_str()) != 0) {
+    remove(temp.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * Function: SongLibrary
+ * ---------------------
+ * Nothing is loaded until start.
+ */
+SongLibrary::SongLibrary() {}
+
+/**
+ * Function: ~SongLibrary
+ * ----------------------
+ * Joins the worker threads.
+ */
+SongLibrary::~SongLibrary() {
+  stop();
+}
+
+/**
+ * Function: start
+ * ---------------
+ * Queues every file and starts worker threads to
+ * load them in order. By default one hardware
+ * thread is left free for rendering.
+ */
+void SongLibrary::start(const vector<string>& fileNames, int numThreads) {
+  stop(); // restart with new files
+
+  files = fileNames;
+  songs.assign(files.size(), Song());
+  states.assign(files.size(), QUEUED);
+  nextIndex = 0;
+  stopping = false;
+
+  if (numThreads <= 0) numThreads = (int) thread::hardware_concurrency() - 1;
+  if (numThreads > (int) files.size()) numThreads = files.size();
+  if (numThreads < 1) numThreads = 1;
+
+  for (int i = 0; i < numThreads; i += 1)
+    workers.push_back(thread(&SongLibrary::work, this));
+}
+
+/**
+ * Function: stop
+ * --------------
+ * Stops claiming new songs and waits for
+ * songs already being loaded to finish.
+ */
+void SongLibrary::stop() {
+  {
+    lock_guard<mutex> guard(lock);
+    stopping = true;
+  }
+
+  for (size_t i = 0; i < workers.size(); i += 1)
+    workers[i].join();
+  workers.clear();
+}
+
+/**
+ * Function: get
+ * -------------
+ * Copies out a loaded song. If it is still queued it
+ * is loaded right here rather than waiting behind the
+ * other songs; if a worker is loading it, we wait.
+ */
+bool SongLibrary::get(int index, Song& song) {
+  if (index < 0 || index >= (int) files.size()) return false;
+  unique_lock<mutex> guard(lock);
+
+  if (states[index] == QUEUED) loadSong(index, guard);
+  while (states[index] == LOADING) finished.wait(guard);
+
+  if (states[index] != LOADED) return false;
+  song = songs[index];
+  return true;
+}
+
+/**
+ * Function: isLoaded
+ * ------------------
+ * True once a song can be fetched without waiting.
+ */
+bool SongLibrary::isLoaded(int index) {
+  if (index < 0 || index >= (int) files.size()) return false;
+  lock_guard<mutex> guard(lock);
+  return states[index] == LOADED || states[index] == FAILED;
+}
+
+/**
+ * Function: work
+ * --------------
+ * Worker loop: claims the next queued song
+ * until none remain or the library stops.
+ */
+void SongLibrary::work() {
+  unique_lock<mutex> guard(lock);
+  while (!stopping) {
+    while (nextIndex < (int) states.size() && states[nextIndex] != QUEUED)
+      nextIndex += 1; // skip songs fetched early
+
+    if (nextIndex >= (int) states.size()) return;
+    loadSong(nextIndex, guard);
+  }
+}
+
+/**
+ * Function: loadSong
+ * ------------------
+ * Loads a claimed song with the lock released so
+ * other songs can be fetched meanwhile.
+ */
+void SongLibrary::loadSong(int index, unique_lock<mutex>& guard) {
+  states[index] = LOADING;
+  guard.unlock();
+
+  Song loaded;
+  bool success = loaded.load(files[index]);
+
+  guard.lock();
+  songs[index].chords.swap(loaded.chords);
+  songs[index].topNotes.swap(loaded.topNotes);
+  songs[index].keys.swap(loaded.keys);
+  states[index] = success ? LOADED : FAILED;
+  finished.notify_all();
+}
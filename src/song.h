@@ -0,0 +1,96 @@
+/**
+ * File: song.h
+ * ---------------------
+ * Play-through songs derived from MIDI
+ * files, with a compiled binary cache
+ * kept next to each file.
+ */
+
+#ifndef SONG_H
+#define SONG_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+using namespace std;
+
+/**
+ * Type: Note
+ * ----------
+ * A simple struct to hold
+ * notes derived from MIDI.
+ */
+struct Note {
+  int note;
+  // in seconds
+  double duration;
+
+  // comparison functions for algorithms
+  bool operator>(const Note& n) const { return note > n.note; }
+  bool operator>=(const Note& n) const { return note >= n.note; }
+  bool operator==(const Note& n) const { return note == n.note; }
+  bool operator<=(const Note& n) const { return note <= n.note; }
+  bool operator<(const Note& n) const { return note < n.note; }
+};
+
+// notes and key chart for play through
+class Song {
+  public:
+    // use the compiled cache when it is current,
+    // otherwise analyze the MIDI and write the cache
+    bool load(const string& fileName);
+
+    // analyze the MIDI file itself
+    bool build(const string& fileName);
+
+    // compiled song next to the MIDI file
+    bool readCache(const string& fileName);
+    bool writeCache(const string& fileName);
+    static string cacheName(const string& fileName);
+
+    // each inner vector holds notes played together
+    vector<vector<Note>> chords;
+    // highest note of each chord
+    vector<Note> topNotes;
+    // hard mode key for each chord
+    vector<char> keys;
+};
+
+// loads every song in the background
+class SongLibrary {
+  public:
+    SongLibrary();
+    ~SongLibrary();
+
+    // begin loading files on worker threads
+    void start(const vector<string>& fileNames, int numThreads = 0);
+    // wait for workers to finish their current songs
+    void stop();
+
+    // copy out a song, loading it on the calling thread
+    // if the workers have not reached it yet
+    bool get(int index, Song& song);
+    bool isLoaded(int index);
+
+  private:
+    enum State { QUEUED, LOADING, LOADED, FAILED };
+
+    // claim and load queued songs
+    void work();
+    void loadSong(int index, unique_lock<mutex>& guard);
+
+    vector<string> files;
+    vector<Song> songs;
+    vector<State> states;
+    int nextIndex = 0;
+    bool stopping = false;
+
+    mutex lock;
+    condition_variable finished;
+    vector<thread> workers;
+};
+
+// guard
+#endif
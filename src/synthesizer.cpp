@@ -7,16 +7,105 @@
  */
 
 #include "synthesizer.h"
+#include <algorithm>
 #include <iostream>
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_AMD64)
+#include <xmmintrin.h>
+#define SYNTH_SSE
+#endif
 using namespace std;
 
+// frames each shard renders at a time
+static const int SHARD_FRAMES = 4096;
+
+// messages one sequencer dispatch may add to a
+// shard: per channel, a seek's note offs and
+// sustain off, a chase of five controllers and
+// 128 notes, then the events due at one frame
+static const int CHASE_MESSAGES = 128 + 1 + 5 + 128;
+static const int FRAME_MESSAGES = 256;
+
+/**
+ * Function: mixInto
+ * -----------------
+ * Adds one shard's samples to the sum,
+ * four at a time where SSE is available.
+ * Each sum is a single float add either
+ * way, so the result does not depend on
+ * the path taken.
+ */
+static void mixInto(float* sum, const float* part, int count) {
+  int i = 0;
+#ifdef SYNTH_SSE
+  for (; i + 4 <= count; i += 4)
+    _mm_storeu_ps(sum + i, _mm_add_ps(_mm_loadu_ps(sum + i), _mm_loadu_ps(part + i)));
+#endif
+  for (; i < count; i += 1) sum[i] += part[i];
+}
+
+/**
+ * Constructor: CommandRing
+ * ------------------------
+ * Starts empty.
+ */
+CommandRing::CommandRing() : writeIndex(0), readIndex(0) {}
+
+/**
+ * Function: push
+ * --------------
+ * Appends a command unless the ring
+ * is full. Only one thread may push.
+ */
+bool CommandRing::push(const SynthCommand& command) {
+  return push(&command, 1);
+}
+
+/**
+ * Function: push
+ * --------------
+ * Appends a batch of commands if they all
+ * fit. They are published by one store, so
+ * the reader never sees part of a batch.
+ */
+bool CommandRing::push(const SynthCommand* batch, int count) {
+  size_t write = writeIndex.load(memory_order_relaxed);
+  size_t used = write - readIndex.load(memory_order_acquire);
+  if (count < 0 || used + count > SIZE) return false;
+
+  for (int i = 0; i < count; i += 1)
+    commands[(write + i) & (SIZE - 1)] = batch[i];
+  // publish the commands to the reader
+  writeIndex.store(write + count, memory_order_release);
+  return true;
+}
+
+/**
+ * Function: pop
+ * -------------
+ * Takes the oldest command if there
+ * is one. Only one thread may pop.
+ */
+bool CommandRing::pop(SynthCommand& command) {
+  size_t read = readIndex.load(memory_order_relaxed);
+  if (read == writeIndex.load(memory_order_acquire)) return false;
+
+  command = commands[read & (SIZE - 1)];
+  // hand the slot back to the writer
+  readIndex.store(read + 1, memory_order_release);
+  return true;
+}
+
 /**
  * Constructor: Synthesizer
  * ------------------------
  * Sets FluidSynth objects to NULL.
  */
 Synthesizer::Synthesizer()
-  : settings(NULL), synth(NULL), driver(NULL) {}
+  : synth(NULL), settings(NULL), driver(NULL), sequencer(NULL),
+    sampleRate(44100), planning(false), blockOffset(0), spillSize(0), generation(0),
+    remaining(0), blockFrames(0), stopping(false) {
+  for (int i = 0; i < 16; i += 1) channelShards[i] = 0;
+}
 
 /**
  * Destructor: Synthesizer
@@ -24,17 +113,31 @@ Synthesizer::Synthesizer()
  * Cleans up FluidSynth objects.
  */
 Synthesizer::~Synthesizer() {
+  // stop the driver first: its thread
+  // renders through this object and
+  // takes the lock while doing so
+  if (driver) delete_fluid_audio_driver(driver);
+  driver = NULL;
+
+  // then the shard workers
+  workLock.lock();
+  stopping = true;
+  workLock.unlock();
+  workStart.notify_all();
+  for (size_t i = 0; i < workers.size(); i += 1)
+    workers[i].join();
+
   // lock synth
   synthLock.lock();
 
   // clean up FluidSynth objects
-  if (synth) delete_fluid_synth(synth);
+  for (size_t i = 0; i < shards.size(); i += 1)
+    delete_fluid_synth(shards[i].synth);
   if (settings) delete_fluid_settings(settings);
-  if (driver) delete_fluid_audio_driver(driver);
+  shards.clear();
 
   synth = NULL;
   settings = NULL;
-  driver = NULL;
 
   // unlock synth
   synthLock.unlock();
@@ -44,9 +147,19 @@ Synthesizer::~Synthesizer() {
  * Function: init
  * --------------
  * Sets synthesizer sampling rate
- * and max polyphony voices.
+ * and max polyphony voices. With
+ * several shards, each instance
+ * plays every nth MIDI channel
+ * with the full polyphony, so up
+ * to numShards times as many
+ * voices can sound. The output
+ * matches a single instance [to
+ * float rounding] only while the
+ * song never needs more than the
+ * polyphony in total; past that,
+ * voices are stolen per shard.
  */
-bool Synthesizer::init(int rate, int polyphony, bool live) {
+bool Synthesizer::init(int rate, int polyphony, bool live, int numShards) {
   if (synth != NULL) {
     // avoid potential reinitialization of synth
     cerr << "Synthesizer already initialized." << endl;
@@ -63,24 +176,67 @@ bool Synthesizer::init(int rate, int polyphony, bool live) {
   settings = new_fluid_settings();
   // set sample rate in fluidsynth settings
   fluid_settings_setnum(settings, (char*) "synth.sample-rate", (double) rate);
+  sampleRate = rate;
 
   // set polyphony and bound
   if (polyphony <= 0) polyphony = 1;
   else if (polyphony > 256) polyphony = 256;
   fluid_settings_setint(settings, (char*) "synth.polyphony", polyphony);
 
-  // instantiate the synth
-  synth = new_fluid_synth(settings);
+  // instantiate the synths [at most one per channel]
+  if (numShards < 1) numShards = 1;
+  else if (numShards > 16) numShards = 16;
+  shards.resize(numShards);
+
+  // a shard's messages for one block: the queue and
+  // up to a block of song events, after which the
+  // block is ended early, plus one more dispatch
+  int channels = (16 + numShards - 1) / numShards;
+  spillSize = CommandRing::SIZE + SHARD_FRAMES;
+  size_t capacity = spillSize + channels * CHASE_MESSAGES + FRAME_MESSAGES;
+
+  for (int i = 0; i < numShards; i += 1) {
+    shards[i].synth = new_fluid_synth(settings);
+    if (shards[i].synth == NULL) {
+      // free the instances made so far
+      cerr << "Cannot create synthesizer instance." << endl;
+      for (int j = 0; j < i; j += 1)
+        delete_fluid_synth(shards[j].synth);
+      delete_fluid_settings(settings);
+      settings = NULL;
+      shards.clear();
+
+      // unlock synth
+      synthLock.unlock();
+      return false;
+    }
+
+    shards[i].success = true;
+    if (numShards == 1) continue;
+
+    // allocated here and not while rendering
+    shards[i].pending.reserve(capacity);
+    shards[i].left.resize(SHARD_FRAMES);
+    shards[i].right.resize(SHARD_FRAMES);
+  }
+
+  synth = shards[0].synth;
+  for (int i = 0; i < 16; i += 1)
+    channelShards[i] = i % numShards;
+  for (int i = 1; i < numShards; i += 1)
+    workers.push_back(thread(&Synthesizer::work, this, i));
 
   if (live) { // go ahead and play FluidSynth live if live mode has been set
     char* defaultDriver = fluid_settings_getstr_default(settings, "audio.driver");
     fluid_settings_setstr(settings, "audio.driver", defaultDriver);
-    driver = new_fluid_audio_driver(settings, synth);
+    // the driver pulls audio through render so sequenced
+    // events are timed to FluidSynth's 64-frame blocks
+    driver = new_fluid_audio_driver2(settings, renderAudio, this);
   }
 
   // unlock synth
   synthLock.unlock();
-  return synth != NULL;
+  return true;
 }
 
 /**
@@ -96,12 +252,14 @@ bool Synthesizer::load(const char* path) {
   synthLock.lock();
 
   // load soundfont and catch any errors in doing so
-  if (fluid_synth_sfload(synth, path, true) == -1) {
-    cerr << "Cannot load font file: " << path << "." << endl;
-
-    // unlock synth
-    synthLock.unlock();
-    return false;
+  for (size_t i = 0; i < shards.size(); i += 1) {
+    if (fluid_synth_sfload(shards[i].synth, path, true) == -1) {
+      cerr << "Cannot load font file: " << path << "." << endl;
+
+      // unlock synth
+      synthLock.unlock();
+      return false;
+    }
   }
 
   // unlock synth
@@ -109,6 +267,20 @@ bool Synthesizer::load(const char* path) {
   return true;
 }
 
+/**
+ * Function: reset
+ * ---------------
+ * Stops all voices and resets the
+ * controllers and effects of every
+ * instance, as between songs.
+ */
+void Synthesizer::reset() {
+  synthLock.lock(); // lock synth
+  for (size_t i = 0; i < shards.size(); i += 1)
+    fluid_synth_system_reset(shards[i].synth);
+  synthLock.unlock(); // unlock synth
+}
+
 /**
  * Function: setInstrument
  * -----------------------
@@ -119,9 +291,7 @@ void Synthesizer::setInstrument(int channel, int program) {
   if(synth == NULL) return;
   if(program < 0 || program > 127) return;
 
-  synthLock.lock(); // lock synth
-  fluid_synth_program_change(synth, channel, program);
-  synthLock.unlock(); // unlock synth
+  send(SynthCommand::PROGRAM, channel, program, 0);
 }
 
 /**
@@ -133,9 +303,7 @@ void Synthesizer::controlChange(int channel, int dataTwo, int dataThree) {
   if (synth == NULL) return;
   if (dataTwo < 0 || dataTwo > 127) return;
 
-  synthLock.lock(); // lock synth
-  fluid_synth_cc(synth, channel, dataTwo, dataThree);
-  synthLock.unlock(); // unlock synth
+  send(SynthCommand::CONTROL, channel, dataTwo, dataThree);
 }
 
 /**
@@ -153,19 +321,13 @@ void Synthesizer::noteOn(int channel, float pitch, int velocity) {
   // find the bend difference
   // float diff = pitch - pitchI;
 
-  // lock synth
-  synthLock.lock();
-  
   // if bend needed
   // if (diff != 0)
     // apply the necessary bend to the note [TODO: does this need a reset]
-    // fluid_synth_pitch_bend(synth, channel, (int) (8192 + diff * 8191));
+    // send(SynthCommand::BEND, channel, (int) (8192 + diff * 8191), 0);
 
   // sound note with the given velocity
-  fluid_synth_noteon(synth, channel, pitch, velocity);
-
-  // unlock synth
-  synthLock.unlock();
+  send(SynthCommand::NOTE_ON, channel, (int) pitch, velocity);
 }
 
 /**
@@ -178,14 +340,8 @@ void Synthesizer::pitchBend(int channel, float pitchDiff) {
   // sanity check on synth
   if (synth == NULL) return;
 
-  // lock synth
-  synthLock.lock();
-
   // pitch bend [TODO: figure out exactly what pitchDiff means]
-  fluid_synth_pitch_bend(synth, channel, (int) (8192 + pitchDiff * 8191));
-
-  // unlock synth
-  synthLock.unlock();
+  send(SynthCommand::BEND, channel, (int) (8192 + pitchDiff * 8191), 0);
 }
 
 /**
@@ -198,9 +354,35 @@ void Synthesizer::noteOff(int channel, int pitch) {
   // sanity check on synth
   if (synth == NULL) return;
 
-  synthLock.lock(); // lock synth
-  fluid_synth_noteoff(synth, channel, pitch);
-  synthLock.unlock(); // unlock synth
+  send(SynthCommand::NOTE_OFF, channel, pitch, 0);
+}
+
+/**
+ * Function: chordOn
+ * -----------------
+ * Turns several notes on together. They are
+ * queued as one batch, so every note starts
+ * at the same sample of the same block.
+ */
+void Synthesizer::chordOn(int channel, const int* pitches,
+    int numPitches, int velocity) {
+  // sanity check on synth
+  if (synth == NULL) return;
+
+  sendChord(SynthCommand::NOTE_ON, channel, pitches, numPitches, velocity);
+}
+
+/**
+ * Function: chordOff
+ * ------------------
+ * Turns several notes off together,
+ * in the same sample of one block.
+ */
+void Synthesizer::chordOff(int channel, const int* pitches, int numPitches) {
+  // sanity check on synth
+  if (synth == NULL) return;
+
+  sendChord(SynthCommand::NOTE_OFF, channel, pitches, numPitches, 0);
 }
 
 /**
@@ -224,9 +406,329 @@ bool Synthesizer::synthesize(float* buffer, unsigned int numFrames) {
   if (synth == NULL) return false;
 
   synthLock.lock(); // lock synth
-  int retVal = fluid_synth_write_float(synth, numFrames, buffer, 0, 2, buffer, 1, 2);
+  bool success = render(buffer, buffer + 1, 2, numFrames);
   synthLock.unlock(); // unlock synth
 
   // return success
-  return retVal == 0;
+  return success;
+}
+
+/**
+ * Function: setSequencer
+ * ----------------------
+ * Attaches a sequencer whose events are
+ * applied as audio is rendered. Notes it
+ * started are released when detached.
+ */
+void Synthesizer::setSequencer(Sequencer* next) {
+  synthLock.lock(); // lock synth
+  if (sequencer != NULL && synth != NULL)
+    sequencer -> silence(this);
+  sequencer = next;
+  synthLock.unlock(); // unlock synth
+}
+
+/**
+ * Function: getSampleRate
+ * -----------------------
+ * Output rate set by init.
+ */
+int Synthesizer::getSampleRate() {
+  return sampleRate;
+}
+
+/**
+ * Function: getNumShards
+ * ----------------------
+ * FluidSynth instances set by init.
+ */
+int Synthesizer::getNumShards() {
+  return shards.size();
+}
+
+/**
+ * Function: apply
+ * ---------------
+ * Sends a message to the instance playing its
+ * channel. While a sharded block is planned,
+ * it is kept with its frame instead, and sent
+ * by the shard as it renders up to that frame.
+ */
+void Synthesizer::apply(int type, int channel, int dataOne, int dataTwo) {
+  if (channel < 0 || channel > 15) return;
+
+  SynthCommand command;
+  command.type = type;
+  command.channel = channel;
+  command.dataOne = dataOne;
+  command.dataTwo = dataTwo;
+  command.offset = blockOffset;
+
+  SynthShard& shard = shards[channelShards[channel]];
+  if (planning) shard.pending.push_back(command);
+  else play(shard.synth, command);
+}
+
+/**
+ * Function: play
+ * --------------
+ * Sends one message to an instance.
+ */
+void Synthesizer::play(fluid_synth_t* synth, const SynthCommand& command) {
+  switch (command.type) {
+    case SynthCommand::NOTE_ON:
+      fluid_synth_noteon(synth, command.channel,
+        command.dataOne, command.dataTwo);
+      break;
+    case SynthCommand::NOTE_OFF:
+      fluid_synth_noteoff(synth, command.channel, command.dataOne);
+      break;
+    case SynthCommand::CONTROL:
+      fluid_synth_cc(synth, command.channel,
+        command.dataOne, command.dataTwo);
+      break;
+    case SynthCommand::PROGRAM:
+      fluid_synth_program_change(synth, command.channel, command.dataOne);
+      break;
+    case SynthCommand::BEND:
+      fluid_synth_pitch_bend(synth, command.channel, command.dataOne);
+      break;
+  }
+}
+
+/**
+ * Function: send
+ * --------------
+ * Queues a channel message for the render
+ * thread instead of locking the synth, so
+ * the app thread never waits on a block.
+ */
+void Synthesizer::send(int type, int channel, int dataOne, int dataTwo) {
+  SynthCommand command;
+  command.type = type;
+  command.channel = channel;
+  command.dataOne = dataOne;
+  command.dataTwo = dataTwo;
+
+  // a full ring means the render thread has
+  // stalled for thousands of messages; drop
+  commands.push(command);
+}
+
+/**
+ * Function: sendChord
+ * -------------------
+ * Queues a message for each pitch with
+ * a single publish to the render thread.
+ * Pitches past the 128 MIDI keys are cut.
+ */
+void Synthesizer::sendChord(int type, int channel, const int* pitches,
+    int numPitches, int velocity) {
+  if (numPitches <= 0) return;
+  // one message per MIDI key at most
+  if (numPitches > CHORD_KEYS) numPitches = CHORD_KEYS;
+
+  // on the stack: no allocation per chord
+  SynthCommand batch[CHORD_KEYS];
+  for (int i = 0; i < numPitches; i += 1) {
+    batch[i].type = type;
+    batch[i].channel = channel;
+    batch[i].dataOne = pitches[i];
+    batch[i].dataTwo = velocity;
+  }
+
+  // dropped whole if the ring is full,
+  // never started or stopped in part
+  commands.push(batch, numPitches);
+}
+
+/**
+ * Function: drainCommands
+ * -----------------------
+ * Applies every queued message
+ * [render thread, lock held].
+ */
+void Synthesizer::drainCommands() {
+  SynthCommand command;
+  while (commands.pop(command))
+    apply(command.type, command.channel, command.dataOne, command.dataTwo);
+}
+
+/**
+ * Function: render
+ * ----------------
+ * Renders frames in slices that end where the
+ * next sequenced event is due, so each event
+ * takes effect at its own sample position.
+ * Queued messages apply at the block start.
+ * The synth lock must be held.
+ */
+bool Synthesizer::render(float* left, float* right, int stride, int numFrames) {
+  if (shards.size() > 1)
+    return renderShards(left, right, stride, numFrames);
+
+  // messages sent since the last block
+  drainCommands();
+
+  int done = 0;
+  while (done < numFrames) {
+    int count = numFrames - done;
+    if (sequencer != NULL) count = sequencer -> dispatch(this, count);
+
+    int offset = done * stride;
+    if (fluid_synth_write_float(synth, count, left, offset, stride,
+        right, offset, stride) != 0) return false;
+
+    if (sequencer != NULL) sequencer -> advance(count);
+    done += count;
+  }
+
+  return true;
+}
+
+/**
+ * Function: renderShards
+ * ----------------------
+ * Sharded render: first runs the queue and the
+ * sequencer over the block, which leaves each
+ * shard a list of its messages and their frames.
+ * Then every shard renders the block on its own
+ * thread, and the shards are summed in order,
+ * so the mix does not depend on thread timing.
+ * A dense passage ends the block early, so the
+ * message lists do not grow while rendering
+ * [unless one frame holds more than a chase
+ * and FRAME_MESSAGES events for a shard].
+ */
+bool Synthesizer::renderShards(float* left, float* right,
+    int stride, int numFrames) {
+  int count = 0;
+  for (int start = 0; start < numFrames; start += count) {
+    count = min(numFrames - start, SHARD_FRAMES);
+
+    planning = true;
+    blockOffset = 0;
+    drainCommands();
+
+    int done = 0;
+    while (done < count) {
+      blockOffset = done;
+      int slice = count - done;
+      if (sequencer != NULL) {
+        slice = sequencer -> dispatch(this, slice);
+        sequencer -> advance(slice);
+      }
+      done += slice;
+
+      bool full = false;
+      for (size_t i = 0; i < shards.size(); i += 1)
+        full = full || shards[i].pending.size() >= spillSize;
+      if (full) break; // render the rest next block
+    }
+
+    count = done;
+    planning = false;
+    blockOffset = 0;
+
+    // wake the workers and render shard zero here
+    workLock.lock();
+    blockFrames = count;
+    remaining = workers.size();
+    generation += 1;
+    workLock.unlock();
+    workStart.notify_all();
+    renderShard(shards[0], count);
+
+    unique_lock<mutex> guard(workLock);
+    workDone.wait(guard, [this]() { return remaining == 0; });
+    guard.unlock();
+
+    bool success = true;
+    for (size_t i = 0; i < shards.size(); i += 1) {
+      success = success && shards[i].success;
+      if (i == 0) continue;
+      mixInto(shards[0].left.data(), shards[i].left.data(), count);
+      mixInto(shards[0].right.data(), shards[i].right.data(), count);
+    }
+    if (!success) return false;
+
+    for (int i = 0; i < count; i += 1) {
+      left[(start + i) * stride] = shards[0].left[i];
+      right[(start + i) * stride] = shards[0].right[i];
+    }
+  }
+
+  return true;
+}
+
+/**
+ * Function: work
+ * --------------
+ * Worker thread of one shard: renders
+ * it for every block, until stopped.
+ */
+void Synthesizer::work(int shard) {
+  long long rendered = 0;
+  while (true) {
+    unique_lock<mutex> guard(workLock);
+    workStart.wait(guard, [&]() {
+      return stopping || generation != rendered;
+    });
+    if (stopping) return;
+    rendered = generation;
+    int count = blockFrames;
+    guard.unlock();
+
+    renderShard(shards[shard], count);
+
+    guard.lock();
+    remaining -= 1;
+    bool last = remaining == 0;
+    guard.unlock();
+    if (last) workDone.notify_one();
+  }
+}
+
+/**
+ * Function: renderShard
+ * ---------------------
+ * Renders one shard's block into its own
+ * buffers, sending each planned message
+ * when its frame is reached.
+ */
+void Synthesizer::renderShard(SynthShard& shard, int numFrames) {
+  shard.success = true;
+  size_t next = 0;
+  int done = 0;
+
+  while (done < numFrames) {
+    while (next < shard.pending.size() && shard.pending[next].offset <= done)
+      play(shard.synth, shard.pending[next++]);
+
+    int until = numFrames;
+    if (next < shard.pending.size()) until = shard.pending[next].offset;
+    if (fluid_synth_write_float(shard.synth, until - done, shard.left.data(),
+        done, 1, shard.right.data(), done, 1) != 0) shard.success = false;
+    done = until;
+  }
+
+  shard.pending.clear();
+}
+
+/**
+ * Function: renderAudio
+ * ---------------------
+ * Called by the FluidSynth audio driver
+ * for each period of live output.
+ */
+int Synthesizer::renderAudio(void* data, int len, int /* nin */,
+    float** /* in */, int nout, float** out) {
+  Synthesizer* self = (Synthesizer*) data;
+  if (nout < 1) return -1;
+
+  self -> synthLock.lock(); // lock synth
+  bool success = self -> render(out[0], out[nout > 1 ? 1 : 0], 1, len);
+  self -> synthLock.unlock(); // unlock synth
+
+  return success ? 0 : -1;
 }
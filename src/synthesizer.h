@@ -9,8 +9,69 @@
 #ifndef SYNTHESIZER_H
 #define SYNTHESIZER_H
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include <fluidsynth.h>
-#include "ofMain.h"
+#include "sequencer.h"
+
+/**
+ * Type: SynthCommand
+ * ------------------
+ * A channel message waiting
+ * for the render thread.
+ */
+struct SynthCommand {
+  enum Type { NOTE_ON, NOTE_OFF, CONTROL, PROGRAM, BEND };
+  unsigned char type;
+  unsigned char channel;
+  int dataOne;
+  int dataTwo;
+  // frames into the block [sharded mode]
+  int offset;
+};
+
+/**
+ * Type: SynthShard
+ * ----------------
+ * One FluidSynth instance in sharded
+ * mode, with the messages and audio
+ * of the block being rendered.
+ */
+struct SynthShard {
+  fluid_synth_t* synth;
+  vector<SynthCommand> pending;
+  vector<float> left;
+  vector<float> right;
+  bool success;
+};
+
+// single producer, single consumer
+// queue that never blocks either side
+class CommandRing {
+  public:
+    static const size_t SIZE = 4096; // power of two
+
+    CommandRing();
+    // app thread: false if full
+    bool push(const SynthCommand& command);
+    // app thread: all or none, seen at once
+    bool push(const SynthCommand* batch, int count);
+    // render thread: false if empty
+    bool pop(SynthCommand& command);
+
+  private:
+    SynthCommand commands[SIZE];
+
+    // indices on separate cache lines
+    char paddingOne[64];
+    atomic<size_t> writeIndex;
+    char paddingTwo[64];
+    atomic<size_t> readIndex;
+    char paddingThree[64];
+};
 
 // plays MIDI audio
 class Synthesizer {
@@ -18,9 +79,18 @@ class Synthesizer {
     Synthesizer();
     ~Synthesizer();
 
-    // initialize synthesizer and load soundfont
-    bool init(int rate, int polyphony, bool live);
+    // pitches one chord message batch holds
+    static const int CHORD_KEYS = 128;
+
+    // initialize synthesizer and load soundfont; with several
+    // shards the channels are spread over that many instances
+    bool init(int rate, int polyphony, bool live, int numShards = 1);
     bool load(const char* path);
+    // reset every instance to its power-on state
+    void reset();
+
+    // channel messages below are queued for the next
+    // rendered block [call from a single app thread]
 
     // program change [set instrument]
     void setInstrument(int channel, int program);
@@ -32,18 +102,74 @@ class Synthesizer {
     void pitchBend(int channel, float pitchDiff);
     // turn off a particular note on a channel
     void noteOff(int channel, int pitch);
+    // start or stop a chord [up to CHORD_KEYS] in the same rendered sample
+    void chordOn(int channel, const int* pitches, int numPitches, int velocity);
+    void chordOff(int channel, const int* pitches, int numPitches);
     // turn off all notes on channel
     void allNotesOff(int channel);
     // synthesize stereo buffer of samples
     bool synthesize(float* buffer, unsigned int numFrames);
 
+    // play a song in time with rendering [NULL detaches]
+    void setSequencer(Sequencer* sequencer);
+    int getSampleRate();
+    int getNumShards();
+
+    // render thread: play a message now, or at its
+    // frame in the block when sharded [lock held]
+    void apply(int type, int channel, int dataOne, int dataTwo);
+
     // TODO: maybe make an accessor
+    // [the instance of shard zero]
     fluid_synth_t* synth;
-    ofMutex synthLock;
+    // held while rendering and setting up, but not
+    // by the channel messages, which are queued
+    mutex synthLock;
 
   protected:
     fluid_settings_t* settings;
     fluid_audio_driver_t* driver;
+    Sequencer* sequencer;
+    int sampleRate;
+    CommandRing commands;
+
+    // queue a message for the next rendered block
+    void send(int type, int channel, int dataOne, int dataTwo);
+    // queue one message per pitch as a single batch
+    void sendChord(int type, int channel, const int* pitches,
+      int numPitches, int velocity);
+    // apply queued messages [render thread]
+    void drainCommands();
+
+    // render with the lock held, splitting at song events
+    bool render(float* left, float* right, int stride, int numFrames);
+    // FluidSynth audio driver callback in live mode
+    static int renderAudio(void* data, int len, int nin,
+      float** in, int nout, float** out);
+
+    // sharded mode: each shard renders on its own thread
+    vector<SynthShard> shards;
+    int channelShards[16]; // shard playing each channel
+    bool planning; // collecting messages of a block
+    int blockOffset; // frame being planned
+    size_t spillSize; // pending messages that end a block
+
+    // shard workers [shard zero renders on the caller]
+    vector<thread> workers;
+    mutex workLock;
+    condition_variable workStart;
+    condition_variable workDone;
+    long long generation; // blocks started
+    int remaining; // shards still rendering
+    int blockFrames;
+    bool stopping;
+
+    // plan a block, render the shards and mix them
+    bool renderShards(float* left, float* right, int stride, int numFrames);
+    void work(int shard); // worker thread loop
+    void renderShard(SynthShard& shard, int numFrames);
+    // send a message to one instance
+    static void play(fluid_synth_t* synth, const SynthCommand& command);
 };
 
 // guard
@@ -0,0 +1,491 @@
+//
+// Filename:      tools/midibench.cpp
+// Syntax:        C++11
+// vim:           ts=3 expandtab
+//
+// Description:   Timing comparisons for the MidiFile library.  Each input
+//                file is parsed repeatedly with the istream reader and
+//                the memory-mapped reader (with and without an event
+//                pool) and the parallel track reader, and the average
+//                time per file and per event is reported for each method.
+//                Joining the tracks of each file with the k-way merge of
+//                joinTracks() is compared to concatenating and sorting
+//                them with eventcompare (as joinTracks() used to do) and
+//                with the radix sort of sortTrack().  The main library
+//                operations (readMapped, joinTracks, splitTracks,
+//                sortTracks, linkNotePairs, doTimeAnalysis and
+//                writeToMemory) are then timed one by one, followed by
+//                the peak resident memory of the process.  Finally note
+//                linking and time analysis over the tracks are compared
+//                to the same scans over a CompactMidiEventList of the
+//                file.  Use -o to time only the operations and the
+//                compact scans (for example on large files made with
+//                midigen).
+//
+// Usage:         midibench [-n repeat] [-t threads] [-o] file.mid
+//                          [file2.mid ...]
+//
+
+#include "MidiFile.h"
+#include "CompactMidiEvent.h"
+#include "Options.h"
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <cstdlib>
+#include <cmath>
+
+#ifdef _WIN32
+   #include <windows.h>
+   #include <psapi.h>
+   #pragma comment(lib, "psapi.lib")
+#else
+   #include <sys/resource.h>
+#endif
+
+using namespace std;
+
+// function declarations:
+void      checkOptions      (Options& opts, int argc, char** argv);
+void      benchmarkRead     (const string& filename);
+void      benchmarkJoin     (const string& filename);
+void      benchmarkOperations(const string& filename);
+void      benchmarkCompact  (const string& filename);
+int       countEvents       (MidiFile& midifile);
+size_t    getFileSize       (const string& filename);
+size_t    getPeakMemory     (void);
+double    elapsedSeconds    (chrono::steady_clock::time_point start);
+void      printResult       (const string& label, double seconds,
+                             int events, size_t bytes);
+
+// global variables:
+Options   options;
+int       repeatQ = 20;       // used with -n option
+int       threadsQ = 0;       // used with -t option
+int       operationsQ = 0;    // used with -o option
+
+
+///////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv) {
+   checkOptions(options, argc, argv);
+   for (int i=1; i<=options.getArgCount(); i++) {
+      if (!operationsQ) {
+         benchmarkRead(options.getArg(i));
+         benchmarkJoin(options.getArg(i));
+      }
+      benchmarkOperations(options.getArg(i));
+      benchmarkCompact(options.getArg(i));
+   }
+   return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////
+//
+// benchmarkRead -- compare MidiFile::read(istream&) against
+//    MidiFile::readMapped() on a single file.
+//
+
+void benchmarkRead(const string& filename) {
+   size_t bytes = getFileSize(filename);
+   if (bytes == 0) {
+      cerr << "Cannot open " << filename << endl;
+      return;
+   }
+
+   MidiFile midifile;
+   int events = 0;
+
+   chrono::steady_clock::time_point start = chrono::steady_clock::now();
+   for (int i=0; i<repeatQ; i++) {
+      fstream input(filename.c_str(), ios::binary | ios::in);
+      midifile.read(input);
+   }
+   double streamtime = elapsedSeconds(start) / repeatQ;
+   events = countEvents(midifile);
+
+   start = chrono::steady_clock::now();
+   for (int i=0; i<repeatQ; i++) {
+      midifile.readMapped(filename);
+   }
+   double mappedtime = elapsedSeconds(start) / repeatQ;
+
+   if (countEvents(midifile) != events) {
+      cerr << "Warning: readers disagree on event count for "
+           << filename << endl;
+   }
+
+   MidiFile pooledfile;
+   pooledfile.setEventPool(1);
+   start = chrono::steady_clock::now();
+   for (int i=0; i<repeatQ; i++) {
+      pooledfile.readMapped(filename);
+   }
+   double pooledtime = elapsedSeconds(start) / repeatQ;
+
+   start = chrono::steady_clock::now();
+   for (int i=0; i<repeatQ; i++) {
+      midifile.readParallel(filename, threadsQ);
+   }
+   double paralleltime = elapsedSeconds(start) / repeatQ;
+
+   if (countEvents(midifile) != events) {
+      cerr << "Warning: parallel reader disagrees on event count for "
+           << filename << endl;
+   }
+
+   cout << filename << ": " << events << " events, "
+        << bytes << " bytes" << endl;
+   printResult("read(istream)", streamtime, events, bytes);
+   printResult("readMapped", mappedtime, events, bytes);
+   printResult("readMapped+pool", pooledtime, events, bytes);
+   printResult("readParallel", paralleltime, events, bytes);
+   if ((mappedtime > 0.0) && (paralleltime > 0.0)) {
+      cout << "\tspeedup: " << fixed << setprecision(2)
+           << streamtime / mappedtime << "x mapped, "
+           << streamtime / paralleltime << "x parallel ("
+           << midifile.getTrackCount() << " tracks)" << endl;
+   }
+}
+
+
+
+//////////////////////////////
+//
+// benchmarkJoin -- compare MidiFile::joinTracks() against sorting the
+//    concatenated tracks with qsort() and eventcompare, and with the
+//    radix sort of MidiFile::sortTrack().
+//
+
+void benchmarkJoin(const string& filename) {
+   MidiFile midifile;
+   if (!midifile.readParallel(filename, threadsQ)) {
+      return;
+   }
+   int events = countEvents(midifile);
+   int tracks = midifile.getTrackCount();
+   if (tracks < 2) {
+      return;
+   }
+
+   double sorttime = 0.0;
+   double radixtime = 0.0;
+   for (int i=0; i<repeatQ; i++) {
+      for (int method=0; method<2; method++) {
+         chrono::steady_clock::time_point start = chrono::steady_clock::now();
+         MidiEventList joined;
+         joined.reserve(events);
+         for (int j=0; j<tracks; j++) {
+            for (int k=0; k<midifile[j].size(); k++) {
+               joined.push_back_no_copy(&midifile[j][k]);
+            }
+         }
+         if (method == 0) {
+            qsort(joined.data(), joined.size(), sizeof(MidiEvent*),
+                  eventcompare);
+            sorttime += elapsedSeconds(start);
+         } else {
+            midifile.sortTrack(joined);
+            radixtime += elapsedSeconds(start);
+         }
+         joined.detach();
+      }
+   }
+   sorttime /= repeatQ;
+   radixtime /= repeatQ;
+
+   double mergetime = 0.0;
+   for (int i=0; i<repeatQ; i++) {
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      midifile.joinTracks();
+      mergetime += elapsedSeconds(start);
+      midifile.splitTracks();
+   }
+   mergetime /= repeatQ;
+
+   printResult("join (qsort)", sorttime, events, 0);
+   printResult("join (sortTrack)", radixtime, events, 0);
+   printResult("joinTracks (merge)", mergetime, events, 0);
+   if (mergetime > 0.0) {
+      cout << "\tjoin speedup: " << fixed << setprecision(2)
+           << sorttime / mergetime << "x (" << tracks << " tracks)" << endl;
+   }
+}
+
+
+
+//////////////////////////////
+//
+// benchmarkOperations -- time the main MidiFile operations separately
+//    on one file, then print the peak memory use of the process so far.
+//
+
+void benchmarkOperations(const string& filename) {
+   size_t bytes = getFileSize(filename);
+   MidiFile midifile;
+   double times[7] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+   chrono::steady_clock::time_point start;
+   for (int i=0; i<repeatQ; i++) {
+      start = chrono::steady_clock::now();
+      if (!midifile.readMapped(filename)) {
+         cerr << "Cannot read " << filename << endl;
+         return;
+      }
+      times[0] += elapsedSeconds(start);
+   }
+   int events = countEvents(midifile);
+
+   vector<uchar> output;
+   for (int i=0; i<repeatQ; i++) {
+      start = chrono::steady_clock::now();
+      midifile.joinTracks();
+      times[1] += elapsedSeconds(start);
+
+      start = chrono::steady_clock::now();
+      midifile.splitTracks();
+      times[2] += elapsedSeconds(start);
+
+      start = chrono::steady_clock::now();
+      midifile.sortTracks();
+      times[3] += elapsedSeconds(start);
+
+      start = chrono::steady_clock::now();
+      midifile.linkNotePairs();
+      times[4] += elapsedSeconds(start);
+
+      start = chrono::steady_clock::now();
+      midifile.doTimeAnalysis();
+      times[5] += elapsedSeconds(start);
+
+      start = chrono::steady_clock::now();
+      midifile.writeToMemory(output);
+      times[6] += elapsedSeconds(start);
+   }
+
+   static const char* labels[7] = {"readMapped", "joinTracks", "splitTracks",
+         "sortTracks", "linkNotePairs", "doTimeAnalysis", "writeToMemory"};
+   cout << filename << ": " << events << " events, "
+        << midifile.getTrackCount() << " tracks, " << bytes << " bytes"
+        << endl;
+   for (int i=0; i<7; i++) {
+      printResult(labels[i], times[i] / repeatQ, events,
+            ((i == 0) || (i == 6)) ? bytes : 0);
+   }
+   cout << "\tpeak memory:  " << fixed << setprecision(1)
+        << getPeakMemory() / 1048576.0 << " MB" << endl;
+}
+
+
+
+//////////////////////////////
+//
+// benchmarkCompact -- compare MidiFile::linkNotePairs() and
+//    MidiFile::doTimeAnalysis() against the same scans over a
+//    CompactMidiEventList of the file, including the cost of filling
+//    and sorting the compact list, and check that both agree.
+//
+
+void benchmarkCompact(const string& filename) {
+   MidiFile midifile;
+   if (!midifile.readMapped(filename)) {
+      return;
+   }
+   midifile.sortTracks();
+   int events = countEvents(midifile);
+   int tpq = midifile.getTicksPerQuarterNote();
+
+   CompactMidiEventList compact;
+   vector<int> links;
+   int pairs = 0;
+   int compactpairs = 0;
+   double times[5] = {0.0, 0.0, 0.0, 0.0, 0.0};
+   chrono::steady_clock::time_point start;
+   for (int i=0; i<repeatQ; i++) {
+      start = chrono::steady_clock::now();
+      pairs = midifile.linkNotePairs();
+      times[0] += elapsedSeconds(start);
+
+      start = chrono::steady_clock::now();
+      midifile.doTimeAnalysis();
+      times[1] += elapsedSeconds(start);
+
+      start = chrono::steady_clock::now();
+      compact.clear();
+      compact.append(midifile);
+      compact.sortByTick();
+      times[2] += elapsedSeconds(start);
+
+      start = chrono::steady_clock::now();
+      compactpairs = compact.linkNotePairs(links);
+      times[3] += elapsedSeconds(start);
+
+      start = chrono::steady_clock::now();
+      compact.doTimeAnalysis(tpq);
+      times[4] += elapsedSeconds(start);
+   }
+
+   // The times of the compact list were copied from the MidiFile, so
+   // clear them and analyze again before checking them:
+   for (int i=0; i<compact.size(); i++) {
+      compact[i].seconds = 0.0;
+   }
+   compact.doTimeAnalysis(tpq);
+   CompactMidiEventList reference;
+   reference.append(midifile);
+   reference.sortByTick();
+   int mismatches = 0;
+   for (int i=0; i<compact.size(); i++) {
+      if ((compact[i].tick != reference[i].tick) ||
+            (fabs(compact[i].seconds - reference[i].seconds) > 1e-6)) {
+         mismatches++;
+      }
+   }
+   if ((compactpairs != pairs) || (mismatches > 0)) {
+      cerr << "Warning: compact list disagrees with MidiFile for "
+           << filename << " (" << compactpairs << " vs " << pairs
+           << " note pairs, " << mismatches << " event times)" << endl;
+   }
+
+   static const char* labels[5] = {"linkNotePairs", "doTimeAnalysis",
+         "compact append", "compact link", "compact time"};
+   for (int i=0; i<5; i++) {
+      printResult(labels[i], times[i] / repeatQ, events, 0);
+   }
+   double scantime = times[3] + times[4];
+   if (scantime > 0.0) {
+      cout << "\tcompact speedup: " << fixed << setprecision(2)
+           << (times[0] + times[1]) / scantime << "x link+time, "
+           << (times[0] + times[1]) / (times[2] + scantime)
+           << "x with append" << endl;
+   }
+}
+
+
+
+//////////////////////////////
+//
+// countEvents -- return the number of events in all tracks.
+//
+
+int countEvents(MidiFile& midifile) {
+   int sum = 0;
+   for (int i=0; i<midifile.getTrackCount(); i++) {
+      sum += midifile[i].size();
+   }
+   return sum;
+}
+
+
+
+//////////////////////////////
+//
+// getFileSize -- return the size of a file in bytes, or 0 if it
+//    cannot be opened.
+//
+
+size_t getFileSize(const string& filename) {
+   fstream probe(filename.c_str(), ios::binary | ios::in);
+   if (!probe.is_open()) {
+      return 0;
+   }
+   probe.seekg(0, ios::end);
+   return (size_t)probe.tellg();
+}
+
+
+
+//////////////////////////////
+//
+// getPeakMemory -- return the peak resident set size of the process
+//    in bytes (0 if unknown).
+//
+
+size_t getPeakMemory(void) {
+#ifdef _WIN32
+   PROCESS_MEMORY_COUNTERS counters;
+   if (GetProcessMemoryInfo(GetCurrentProcess(), &counters,
+         sizeof(counters))) {
+      return counters.PeakWorkingSetSize;
+   }
+   return 0;
+#else
+   struct rusage usage;
+   if (getrusage(RUSAGE_SELF, &usage) != 0) {
+      return 0;
+   }
+   #ifdef __APPLE__
+      return (size_t)usage.ru_maxrss;          // bytes
+   #else
+      return (size_t)usage.ru_maxrss * 1024;   // kilobytes
+   #endif
+#endif
+}
+
+
+
+//////////////////////////////
+//
+// elapsedSeconds -- time since the given starting point.
+//
+
+double elapsedSeconds(chrono::steady_clock::time_point start) {
+   chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+   return elapsed.count();
+}
+
+
+
+//////////////////////////////
+//
+// printResult -- print timing for one method.
+//
+
+void printResult(const string& label, double seconds, int events,
+      size_t bytes) {
+   cout << "\t" << left << setw(20) << label << right << fixed
+        << setprecision(3) << setw(10) << seconds * 1000.0 << " ms";
+   if (events > 0) {
+      cout << setprecision(1) << setw(10) << seconds * 1e9 / events
+           << " ns/event";
+   }
+   if ((seconds > 0.0) && (bytes > 0)) {
+      cout << setprecision(1) << setw(10) << bytes / seconds / 1e6
+           << " MB/s";
+   }
+   cout << endl;
+}
+
+
+
+//////////////////////////////
+//
+// checkOptions -- process the command-line options.
+//
+
+void checkOptions(Options& opts, int argc, char** argv) {
+   opts.define("n|repeat=i:20", "number of times to parse each file");
+   opts.define("t|threads=i:0", "thread count for parallel reader (0=all)");
+   opts.define("o|operations=b", "only time the individual operations");
+   opts.process(argc, argv);
+
+   repeatQ = opts.getInteger("repeat");
+   if (repeatQ < 1) {
+      repeatQ = 1;
+   }
+   threadsQ = opts.getInteger("threads");
+   operationsQ = opts.getBoolean("operations");
+   if (opts.getArgCount() < 1) {
+      cerr << "Usage: " << opts.getCommand()
+           << " [-n repeat] [-t threads] [-o] file.mid [file2.mid ...]"
+           << endl;
+      exit(1);
+   }
+}
+
+
+
@@ -0,0 +1,513 @@
+//
+// Filename:      tools/midicorpus.cpp
+// Syntax:        C++11
+// vim:           ts=3 expandtab
+//
+// Description:   Batch analysis of a collection of MIDI files.  Every
+//                Standard MIDI or binasc file given on the command line,
+//                or found in the directories given on the command line,
+//                is parsed and analyzed on a pool of worker threads.
+//                Each worker starts with its own share of the files and
+//                steals from the other workers when its share runs out,
+//                so a few very large files do not leave the other
+//                threads idle.  For each file the number of tracks and
+//                events, the duration in seconds, the number of tempo
+//                changes, the number and range of notes, and the parse
+//                time and throughput are printed, followed by totals for
+//                the whole collection.  Files which fail to parse are
+//                listed with an error status.
+//
+// Usage:         midicorpus [-j threads] [-l] [-s] [-x extensions]
+//                      dir-or-file [dir-or-file ...]
+//
+
+#include "MidiFile.h"
+#include "MappedFile.h"
+#include "Options.h"
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <cstdlib>
+#include <cctype>
+
+#ifdef _WIN32
+   #include <windows.h>
+#else
+   #include <dirent.h>
+   #include <sys/stat.h>
+#endif
+
+using namespace std;
+
+// analysis results for one file:
+class FileReport {
+   public:
+      int       status = 0;      // 1 if the file was parsed
+      size_t    bytes = 0;       // size of the file
+      int       tracks = 0;
+      int       events = 0;
+      double    duration = 0.0;  // seconds to the last event
+      int       tempos = 0;      // tempo meta messages
+      int       notes = 0;       // note-ons with non-zero velocity
+      int       lowest = -1;     // lowest key number of the notes
+      int       highest = -1;    // highest key number of the notes
+      double    parsetime = 0.0; // seconds spent parsing
+};
+
+// work-stealing pool of worker threads for a fixed set of jobs:
+class WorkStealingPool {
+   public:
+      void      run               (int jobCount, int threadCount,
+                                   const function<void(int)>& job);
+
+   private:
+      class JobQueue {
+         public:
+            mutex      lock;
+            deque<int> jobs;
+      };
+
+      void      work              (int worker, vector<JobQueue>& queues,
+                                   const function<void(int)>& job);
+      int       takeJob           (JobQueue& queue, int ownerQ);
+};
+
+// function declarations:
+void      checkOptions      (Options& opts, int argc, char** argv);
+void      collectFiles      (const string& path, vector<string>& files);
+int       isDirectory       (const string& path);
+int       hasMidiExtension  (const string& path);
+void      analyzeFile       (const string& filename, FileReport& report);
+void      printReport       (const string& filename, FileReport& report);
+void      printSummary      (vector<FileReport>& reports, double walltime);
+double    elapsedSeconds    (chrono::steady_clock::time_point start);
+
+// global variables:
+Options        options;
+int            threadsQ = 0;      // used with -j option
+int            shallowQ = 0;      // used with -l option
+int            summaryQ = 0;      // used with -s option
+vector<string> extensions;        // used with -x option
+
+
+///////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv) {
+   checkOptions(options, argc, argv);
+
+   vector<string> files;
+   for (int i=1; i<=options.getArgCount(); i++) {
+      const string& path = options.getArg(i);
+      if (isDirectory(path)) {
+         vector<string> found;
+         collectFiles(path, found);
+         sort(found.begin(), found.end());
+         files.insert(files.end(), found.begin(), found.end());
+      } else {
+         files.push_back(path);
+      }
+   }
+   if (files.empty()) {
+      cerr << "No MIDI files found" << endl;
+      return 1;
+   }
+
+   vector<FileReport> reports(files.size());
+   chrono::steady_clock::time_point start = chrono::steady_clock::now();
+   WorkStealingPool pool;
+   pool.run((int)files.size(), threadsQ, [&](int index) {
+      analyzeFile(files[index], reports[index]);
+   });
+   double walltime = elapsedSeconds(start);
+
+   if (!summaryQ) {
+      cout << "#events\ttracks\tseconds\ttempos\tnotes\trange\t"
+           << "parse-ms\tMB/s\tfile" << endl;
+      for (int i=0; i<(int)files.size(); i++) {
+         printReport(files[i], reports[i]);
+      }
+   }
+   printSummary(reports, walltime);
+
+   for (int i=0; i<(int)reports.size(); i++) {
+      if (!reports[i].status) {
+         return 1;
+      }
+   }
+   return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////
+//
+// WorkStealingPool::run -- call job(i) for every i from 0 to jobCount-1
+//    on threadCount threads (all hardware threads if 0).  Each worker
+//    starts with a contiguous block of jobs, which it takes from the
+//    front; idle workers steal from the back of the other blocks.
+//    Returns when all jobs are done.
+//
+
+void WorkStealingPool::run(int jobCount, int threadCount,
+      const function<void(int)>& job) {
+   if (threadCount <= 0) {
+      threadCount = (int)thread::hardware_concurrency();
+   }
+   if (threadCount > jobCount) {
+      threadCount = jobCount;
+   }
+   if (threadCount < 1) {
+      threadCount = 1;
+   }
+
+   vector<JobQueue> queues(threadCount);
+   for (int i=0; i<threadCount; i++) {
+      int first = (int)((long long)jobCount * i / threadCount);
+      int last  = (int)((long long)jobCount * (i+1) / threadCount);
+      for (int j=first; j<last; j++) {
+         queues[i].jobs.push_back(j);
+      }
+   }
+
+   vector<thread> workers;
+   for (int i=1; i<threadCount; i++) {
+      workers.push_back(thread(&WorkStealingPool::work, this, i,
+            ref(queues), cref(job)));
+   }
+   work(0, queues, job);
+   for (int i=0; i<(int)workers.size(); i++) {
+      workers[i].join();
+   }
+}
+
+
+
+//////////////////////////////
+//
+// WorkStealingPool::work -- run the jobs of one worker, then steal
+//    from the others until every queue is empty.  No jobs are added
+//    after the start, so an empty sweep means that the work is done.
+//
+
+void WorkStealingPool::work(int worker, vector<JobQueue>& queues,
+      const function<void(int)>& job) {
+   int count = (int)queues.size();
+   while (true) {
+      int index = takeJob(queues[worker], 1);
+      for (int i=1; (index < 0) && (i<count); i++) {
+         index = takeJob(queues[(worker + i) % count], 0);
+      }
+      if (index < 0) {
+         return;
+      }
+      job(index);
+   }
+}
+
+
+
+//////////////////////////////
+//
+// WorkStealingPool::takeJob -- remove a job from the front of the queue
+//    for its owner, or from the back for a thief.  Returns -1 if the
+//    queue is empty.
+//
+
+int WorkStealingPool::takeJob(JobQueue& queue, int ownerQ) {
+   lock_guard<mutex> guard(queue.lock);
+   if (queue.jobs.empty()) {
+      return -1;
+   }
+   int index;
+   if (ownerQ) {
+      index = queue.jobs.front();
+      queue.jobs.pop_front();
+   } else {
+      index = queue.jobs.back();
+      queue.jobs.pop_back();
+   }
+   return index;
+}
+
+
+
+//////////////////////////////
+//
+// analyzeFile -- parse one file and gather its statistics.
+//
+
+void analyzeFile(const string& filename, FileReport& report) {
+   MappedFile input;
+   if (!input.open(filename)) {
+      cerr << "Cannot open " << filename << endl;
+      return;
+   }
+   report.bytes = input.size();
+
+   MidiFile midifile;
+   midifile.setFilename(filename);
+   chrono::steady_clock::time_point start = chrono::steady_clock::now();
+   report.status = midifile.readFromMemory(input.data(), input.size());
+   report.parsetime = elapsedSeconds(start);
+   if (!report.status) {
+      return;
+   }
+
+   midifile.doTimeAnalysis();
+   report.tracks = midifile.getTrackCount();
+   for (int i=0; i<midifile.getTrackCount(); i++) {
+      MidiEventList& track = midifile[i];
+      report.events += track.size();
+      for (int j=0; j<track.size(); j++) {
+         MidiEvent& event = track[j];
+         if (event.seconds > report.duration) {
+            report.duration = event.seconds;
+         }
+         if (event.isTempo()) {
+            report.tempos++;
+         } else if (event.isNoteOn()) {
+            int key = event.getKeyNumber();
+            if ((report.notes == 0) || (key < report.lowest)) {
+               report.lowest = key;
+            }
+            if ((report.notes == 0) || (key > report.highest)) {
+               report.highest = key;
+            }
+            report.notes++;
+         }
+      }
+   }
+}
+
+
+
+//////////////////////////////
+//
+// printReport -- print the statistics for one file.
+//
+
+void printReport(const string& filename, FileReport& report) {
+   if (!report.status) {
+      cout << "error\t\t\t\t\t\t\t\t" << filename << endl;
+      return;
+   }
+   stringstream range;
+   if (report.notes > 0) {
+      range << report.lowest << "-" << report.highest;
+   } else {
+      range << "-";
+   }
+   cout << report.events
+        << "\t" << report.tracks
+        << "\t" << fixed << setprecision(2) << report.duration
+        << "\t" << report.tempos
+        << "\t" << report.notes
+        << "\t" << range.str()
+        << "\t" << setprecision(3) << report.parsetime * 1000.0
+        << "\t" << setprecision(1);
+   if (report.parsetime > 0.0) {
+      cout << report.bytes / report.parsetime / 1e6;
+   } else {
+      cout << "-";
+   }
+   cout << "\t" << filename << endl;
+}
+
+
+
+//////////////////////////////
+//
+// printSummary -- print totals for the whole collection.  The parse
+//    throughput adds up the time spent parsing on all threads, while the
+//    overall throughput is measured against the wall-clock time.
+//
+
+void printSummary(vector<FileReport>& reports, double walltime) {
+   int failures = 0;
+   long long events = 0;
+   long long notes = 0;
+   size_t bytes = 0;
+   double duration = 0.0;
+   double parsetime = 0.0;
+   for (int i=0; i<(int)reports.size(); i++) {
+      if (!reports[i].status) {
+         failures++;
+         continue;
+      }
+      events    += reports[i].events;
+      notes     += reports[i].notes;
+      bytes     += reports[i].bytes;
+      duration  += reports[i].duration;
+      parsetime += reports[i].parsetime;
+   }
+
+   cout << "# files:      " << reports.size() << " (" << failures
+        << " failed)" << endl;
+   cout << "# events:     " << events << " (" << notes << " notes)" << endl;
+   cout << "# music:      " << fixed << setprecision(1) << duration / 3600.0
+        << " hours" << endl;
+   cout << "# bytes:      " << bytes << endl;
+   cout << "# parse time: " << setprecision(3) << parsetime << " s";
+   if (parsetime > 0.0) {
+      cout << " (" << setprecision(1) << bytes / parsetime / 1e6
+           << " MB/s per thread)";
+   }
+   cout << endl;
+   cout << "# wall time:  " << setprecision(3) << walltime << " s";
+   if (walltime > 0.0) {
+      cout << " (" << setprecision(1) << bytes / walltime / 1e6
+           << " MB/s, " << setprecision(0) << reports.size() / walltime
+           << " files/s)";
+   }
+   cout << endl;
+}
+
+
+
+//////////////////////////////
+//
+// collectFiles -- add the MIDI files in a directory to the list,
+//    descending into subdirectories unless -l was given.
+//
+
+void collectFiles(const string& path, vector<string>& files) {
+   vector<string> entries;
+#ifdef _WIN32
+   WIN32_FIND_DATAA data;
+   HANDLE handle = FindFirstFileA((path + "\\*").c_str(), &data);
+   if (handle == INVALID_HANDLE_VALUE) {
+      cerr << "Cannot read directory " << path << endl;
+      return;
+   }
+   do {
+      entries.push_back(data.cFileName);
+   } while (FindNextFileA(handle, &data));
+   FindClose(handle);
+#else
+   DIR* dir = opendir(path.c_str());
+   if (dir == NULL) {
+      cerr << "Cannot read directory " << path << endl;
+      return;
+   }
+   struct dirent* entry;
+   while ((entry = readdir(dir)) != NULL) {
+      entries.push_back(entry->d_name);
+   }
+   closedir(dir);
+#endif
+
+   for (int i=0; i<(int)entries.size(); i++) {
+      if ((entries[i] == ".") || (entries[i] == "..")) {
+         continue;
+      }
+      string child = path + "/" + entries[i];
+      if (isDirectory(child)) {
+         if (!shallowQ) {
+            collectFiles(child, files);
+         }
+      } else if (hasMidiExtension(child)) {
+         files.push_back(child);
+      }
+   }
+}
+
+
+
+//////////////////////////////
+//
+// isDirectory -- true if the path names a directory.
+//
+
+int isDirectory(const string& path) {
+#ifdef _WIN32
+   DWORD attributes = GetFileAttributesA(path.c_str());
+   return (attributes != INVALID_FILE_ATTRIBUTES) &&
+          (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+   struct stat info;
+   if (stat(path.c_str(), &info) != 0) {
+      return 0;
+   }
+   return S_ISDIR(info.st_mode);
+#endif
+}
+
+
+
+//////////////////////////////
+//
+// hasMidiExtension -- true if the file name ends with one of the
+//    extensions given with -x (case-insensitive).
+//
+
+int hasMidiExtension(const string& path) {
+   size_t dot = path.rfind('.');
+   if ((dot == string::npos) || (path.find('/', dot) != string::npos)) {
+      return 0;
+   }
+   string extension = path.substr(dot + 1);
+   for (int i=0; i<(int)extension.size(); i++) {
+      extension[i] = (char)tolower((unsigned char)extension[i]);
+   }
+   return find(extensions.begin(), extensions.end(), extension) !=
+          extensions.end();
+}
+
+
+
+//////////////////////////////
+//
+// elapsedSeconds -- time since the given starting point.
+//
+
+double elapsedSeconds(chrono::steady_clock::time_point start) {
+   chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+   return elapsed.count();
+}
+
+
+
+//////////////////////////////
+//
+// checkOptions -- process the command-line options.
+//
+
+void checkOptions(Options& opts, int argc, char** argv) {
+   opts.define("j|threads=i:0", "number of worker threads (0=all)");
+   opts.define("l|shallow=b", "do not descend into subdirectories");
+   opts.define("s|summary=b", "print only the totals");
+   opts.define("x|extensions=s:mid,midi,kar,smf,binasc",
+         "comma-separated file extensions searched for in directories");
+   opts.process(argc, argv);
+
+   threadsQ = opts.getInteger("threads");
+   shallowQ = opts.getBoolean("shallow");
+   summaryQ = opts.getBoolean("summary");
+
+   string list = opts.getString("extensions");
+   stringstream items(list);
+   string item;
+   while (getline(items, item, ',')) {
+      for (int i=0; i<(int)item.size(); i++) {
+         item[i] = (char)tolower((unsigned char)item[i]);
+      }
+      if (!item.empty()) {
+         extensions.push_back(item);
+      }
+   }
+
+   if (opts.getArgCount() < 1) {
+      cerr << "Usage: " << opts.getCommand()
+           << " [-j threads] [-l] [-s] [-x extensions]"
+           << " dir-or-file [dir-or-file ...]" << endl;
+      exit(1);
+   }
+}
@@ -0,0 +1,379 @@
+//
+// Filename:      tools/midigen.cpp
+// Syntax:        C++11
+// vim:           ts=3 expandtab
+//
+// Description:   Generates synthetic Standard MIDI Files for benchmarking
+//                the MidiFile library.  The track count, event density,
+//                number of tempo changes and share of sysex messages can
+//                be set, and the size of the file is given either as a
+//                number of events per track or as a target file size
+//                (from kilobytes up to hundreds of megabytes).  Tracks
+//                are encoded directly into bytes, so large files do not
+//                need to fit in memory as MidiEvents.
+//
+// Usage:         midigen [-t tracks] [-e events | -s size] [-d density]
+//                        [-T tempos] [-x sysex%] [-q tpq] [-r seed]
+//                        output.mid
+//
+
+#include "Options.h"
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <random>
+#include <cstdlib>
+#include <cctype>
+
+using namespace std;
+
+typedef unsigned char uchar;
+
+// function declarations:
+void      checkOptions      (Options& opts, int argc, char** argv);
+long long parseSize         (const string& text);
+void      makeTrack         (vector<uchar>& data, int track,
+                             long long events, long long bytes,
+                             int notetrack, int tempotrack,
+                             long long length, mt19937& random);
+void      appendVLV         (vector<uchar>& data, unsigned long value);
+void      appendTempo       (vector<uchar>& data, unsigned long delta,
+                             mt19937& random);
+void      appendBigEndian   (vector<uchar>& data, unsigned long value,
+                             int count);
+
+// global variables:
+Options   options;
+int       tracksQ = 16;       // used with -t option
+long long eventsQ = 10000;    // used with -e option
+long long sizeQ = 0;          // used with -s option
+double    densityQ = 8.0;     // used with -d option
+int       temposQ = 10;       // used with -T option
+double    sysexQ = 1.0;       // used with -x option
+int       tpqQ = 480;         // used with -q option
+int       seedQ = 1;          // used with -r option
+
+
+///////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv) {
+   checkOptions(options, argc, argv);
+
+   // Note tracks are all tracks except the tempo track of a type-1 file:
+   int notetracks = tracksQ > 1 ? tracksQ - 1 : 1;
+   long long events = eventsQ;
+   long long trackbytes = 0;
+   if (sizeQ > 0) {
+      trackbytes = sizeQ / notetracks;
+      // estimate for the song length; events are about 3 bytes long:
+      events = trackbytes / 3;
+   }
+   // song length in ticks, for spacing the tempo changes:
+   long long length = (long long)(events * tpqQ / densityQ) + 1;
+
+   ofstream output(options.getArg(1).c_str(), ios::binary | ios::out);
+   if (!output.is_open()) {
+      cerr << "Cannot write " << options.getArg(1) << endl;
+      return 1;
+   }
+
+   vector<uchar> data;
+   appendBigEndian(data, 0x4d546864, 4);   // "MThd"
+   appendBigEndian(data, 6, 4);
+   appendBigEndian(data, tracksQ > 1 ? 1 : 0, 2);
+   appendBigEndian(data, tracksQ, 2);
+   appendBigEndian(data, tpqQ, 2);
+   output.write((const char*)data.data(), data.size());
+
+   mt19937 random(seedQ);
+   size_t total = data.size();
+   for (int i=0; i<tracksQ; i++) {
+      int notes  = (tracksQ == 1) || (i > 0);
+      int tempos = (i == 0);
+      data.clear();
+      makeTrack(data, i, notes ? events : 0, notes ? trackbytes : 0,
+            notes, tempos, length, random);
+      uchar header[8] = {'M', 'T', 'r', 'k', 0, 0, 0, 0};
+      unsigned long size = data.size();
+      for (int j=0; j<4; j++) {
+         header[4 + j] = (size >> (24 - 8 * j)) & 0xff;
+      }
+      output.write((const char*)header, 8);
+      output.write((const char*)data.data(), data.size());
+      total += 8 + data.size();
+   }
+   output.close();
+   if (!output) {
+      cerr << "Error writing " << options.getArg(1) << endl;
+      return 1;
+   }
+
+   cerr << options.getArg(1) << ": " << tracksQ << " tracks, "
+        << total << " bytes" << endl;
+   return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////
+//
+// makeTrack -- encode one track.  Note tracks get notes (on one channel
+//    per track, with chords and overlapping notes), controllers, pitch
+//    bends, program changes and sysex messages, until either the event
+//    count or the byte count (if nonzero) is reached.  The tempo changes
+//    are spread over the song length in the tempo track.
+//
+
+void makeTrack(vector<uchar>& data, int track, long long events,
+      long long bytes, int notetrack, int tempotrack, long long length,
+      mt19937& random) {
+   if (bytes > 0) {
+      data.reserve(bytes + 1024);
+   } else {
+      data.reserve(events * 3 + 1024);
+   }
+
+   // track name:
+   string name = "midigen track " + to_string(track);
+   data.push_back(0x00);
+   data.push_back(0xff);
+   data.push_back(0x03);
+   appendVLV(data, name.size());
+   data.insert(data.end(), name.begin(), name.end());
+
+   int channel = (track > 0 ? track - 1 : 0) % 16;
+   int tempocount = tempotrack ? temposQ : 0;
+   int tempoindex = 0;
+   long long tick = 0;
+   long long lasttick = 0;
+   double meandelta = tpqQ / densityQ;
+   exponential_distribution<double> deltas(1.0 / meandelta);
+   uniform_real_distribution<double> chance(0.0, 100.0);
+   vector<int> active;
+   uchar running = 0;
+
+   long long count = 0;
+   while (notetrack && ((bytes > 0) ? ((long long)data.size() < bytes) :
+         (count < events))) {
+      // chords: a third of the events start at the same tick
+      if (chance(random) >= 33.0) {
+         tick += (long long)deltas(random);
+      }
+      while ((tempoindex < tempocount) &&
+            (length * tempoindex / tempocount <= tick)) {
+         long long tempotick = length * tempoindex / tempocount;
+         appendTempo(data, (unsigned long)(tempotick - lasttick), random);
+         lasttick = tempotick;
+         running = 0;
+         tempoindex++;
+      }
+      appendVLV(data, (unsigned long)(tick - lasttick));
+      lasttick = tick;
+      count++;
+
+      double kind = chance(random);
+      if (kind < sysexQ) {
+         // a short sysex message (e.g., a GS/XG parameter change)
+         int size = 6 + random() % 10;
+         data.push_back(0xf0);
+         appendVLV(data, size);
+         for (int i=0; i<size-1; i++) {
+            data.push_back(random() & 0x7f);
+         }
+         data.push_back(0xf7);
+         running = 0;
+         continue;
+      }
+      kind = chance(random);
+      uchar command;
+      uchar p1;
+      uchar p2;
+      if (kind < 80.0) {
+         if ((active.size() < 8) && (active.empty() || (random() & 1))) {
+            p1 = 36 + random() % 60;
+            p2 = 1 + random() % 127;
+            active.push_back(p1);
+         } else {
+            int which = random() % active.size();
+            p1 = active[which];
+            p2 = 0;
+            active[which] = active.back();
+            active.pop_back();
+         }
+         command = 0x90 | channel;
+      } else if (kind < 92.0) {
+         static const uchar controllers[6] = {1, 7, 10, 11, 64, 91};
+         command = 0xb0 | channel;
+         p1 = controllers[random() % 6];
+         p2 = random() & 0x7f;
+      } else if (kind < 99.0) {
+         command = 0xe0 | channel;
+         p1 = random() & 0x7f;
+         p2 = random() & 0x7f;
+      } else {
+         command = 0xc0 | channel;
+         p1 = random() & 0x7f;
+         p2 = 0x80;   // no second data byte
+      }
+      if (command != running) {
+         data.push_back(command);
+         running = command;
+      }
+      data.push_back(p1);
+      if (p2 < 0x80) {
+         data.push_back(p2);
+      }
+   }
+
+   // end the notes which are still on:
+   for (int i=0; i<(int)active.size(); i++) {
+      appendVLV(data, i == 0 ? (unsigned long)tpqQ : 0);
+      data.push_back(0x80 | channel);
+      data.push_back(active[i]);
+      data.push_back(0);
+   }
+   // remaining tempo changes (all of them in the tempo track):
+   while (tempoindex < tempocount) {
+      long long tempotick = length * tempoindex / tempocount;
+      if (tempotick < lasttick) {
+         tempotick = lasttick;
+      }
+      appendTempo(data, (unsigned long)(tempotick - lasttick), random);
+      lasttick = tempotick;
+      tempoindex++;
+   }
+
+   // end of track:
+   data.push_back(0x00);
+   data.push_back(0xff);
+   data.push_back(0x2f);
+   data.push_back(0x00);
+}
+
+
+
+//////////////////////////////
+//
+// appendTempo -- add a tempo meta message between 60 and 180 bpm.
+//
+
+void appendTempo(vector<uchar>& data, unsigned long delta,
+      mt19937& random) {
+   unsigned long bpm = 60 + random() % 121;
+   appendVLV(data, delta);
+   data.push_back(0xff);
+   data.push_back(0x51);
+   data.push_back(0x03);
+   appendBigEndian(data, 60000000 / bpm, 3);
+}
+
+
+
+//////////////////////////////
+//
+// appendVLV -- add a variable-length value.
+//
+
+void appendVLV(vector<uchar>& data, unsigned long value) {
+   uchar bytes[5];
+   int length = 0;
+   do {
+      bytes[length++] = value & 0x7f;
+      value >>= 7;
+   } while (value && (length < 5));
+   for (int i=length-1; i>0; i--) {
+      data.push_back(bytes[i] | 0x80);
+   }
+   data.push_back(bytes[0]);
+}
+
+
+
+//////////////////////////////
+//
+// appendBigEndian -- add the lowest count bytes of a value, most
+//    significant byte first.
+//
+
+void appendBigEndian(vector<uchar>& data, unsigned long value, int count) {
+   for (int i=count-1; i>=0; i--) {
+      data.push_back((value >> (8 * i)) & 0xff);
+   }
+}
+
+
+
+//////////////////////////////
+//
+// parseSize -- read a byte count with an optional K, M or G suffix.
+//
+
+long long parseSize(const string& text) {
+   char* end = NULL;
+   double value = strtod(text.c_str(), &end);
+   switch (toupper(*end)) {
+      case 'K': value *= 1024.0; break;
+      case 'M': value *= 1024.0 * 1024.0; break;
+      case 'G': value *= 1024.0 * 1024.0 * 1024.0; break;
+   }
+   return (long long)value;
+}
+
+
+
+//////////////////////////////
+//
+// checkOptions -- process the command-line options.
+//
+
+void checkOptions(Options& opts, int argc, char** argv) {
+   opts.define("t|tracks=i:16", "number of tracks (tempo track included)");
+   opts.define("e|events=i:10000", "number of events in each note track");
+   opts.define("s|size=s:", "target file size, e.g. 500K, 200M (overrides -e)");
+   opts.define("d|density=d:8.0", "average events per quarter note");
+   opts.define("T|tempos=i:10", "number of tempo changes");
+   opts.define("x|sysex=d:1.0", "percentage of events which are sysex");
+   opts.define("q|tpq=i:480", "ticks per quarter note");
+   opts.define("r|seed=i:1", "random seed");
+   opts.process(argc, argv);
+
+   tracksQ = opts.getInteger("tracks");
+   if (tracksQ < 1) {
+      tracksQ = 1;
+   } else if (tracksQ > 65535) {
+      tracksQ = 65535;
+   }
+   eventsQ = opts.getInteger("events");
+   if (eventsQ < 0) {
+      eventsQ = 0;
+   }
+   if (opts.getBoolean("size")) {
+      sizeQ = parseSize(opts.getString("size"));
+   }
+   densityQ = opts.getDouble("density");
+   if (densityQ <= 0.0) {
+      densityQ = 8.0;
+   }
+   temposQ = opts.getInteger("tempos");
+   if (temposQ < 0) {
+      temposQ = 0;
+   }
+   sysexQ = opts.getDouble("sysex");
+   tpqQ = opts.getInteger("tpq");
+   if ((tpqQ < 1) || (tpqQ > 0x7fff)) {
+      tpqQ = 480;
+   }
+   seedQ = opts.getInteger("seed");
+
+   if (opts.getArgCount() != 1) {
+      cerr << "Usage: " << opts.getCommand()
+           << " [-t tracks] [-e events | -s size] [-d density] [-T tempos]"
+           << " [-x sysex%] [-q tpq] [-r seed] output.mid" << endl;
+      exit(1);
+   }
+}
+
+
+
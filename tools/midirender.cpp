@@ -0,0 +1,448 @@
+//
+// Filename:      tools/midirender.cpp
+// Syntax:        C++11
+// vim:           ts=3 expandtab
+//
+// Description:   Renders MIDI files to WAV files faster than realtime,
+//                for reference audio and backing tracks.  Each file is
+//                time-analyzed and played by a Sequencer through a
+//                Synthesizer without an audio driver, which renders
+//                large blocks that are streamed to the WAV file as they
+//                are made.  The files are shared among worker threads
+//                (one synthesizer with its own copy of the SoundFont per
+//                thread), and the speed of each render and of the whole
+//                batch is reported as a multiple of realtime.  With -n,
+//                the channels of each song are spread over several
+//                FluidSynth instances which render on their own threads.
+//                Each instance has the full polyphony, so the output only
+//                matches a single instance while a song stays within it.
+//
+// Usage:         midirender [-s soundfont] [-o directory] [-j threads]
+//                      [-n shards] [-b block] [-r rate] [-p polyphony]
+//                      [-t tail] [-f] file.mid [file.mid ...]
+//
+
+#include "synthesizer.h"
+#include "sequencer.h"
+#include "MidiFile.h"
+#include "Options.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+
+using namespace std;
+
+// results for one file:
+class RenderReport {
+   public:
+      int       status = 0;       // 1 if the file was rendered
+      double    duration = 0.0;   // seconds of audio written
+      double    rendertime = 0.0; // seconds spent rendering and writing
+      string    output;           // name of the WAV file
+};
+
+// function declarations:
+void      checkOptions      (Options& opts, int argc, char** argv);
+void      renderWorker      (vector<string>& files,
+                             vector<RenderReport>& reports,
+                             atomic<int>& next);
+void      renderFile        (Synthesizer& synth, const string& filename,
+                             RenderReport& report);
+string    getOutputName     (const string& filename);
+void      writeWaveHeader   (ostream& output, unsigned long long frames);
+void      writeSamples      (ostream& output, const float* samples,
+                             int count, vector<char>& bytes);
+void      appendLittleEndian(vector<char>& data, unsigned long value,
+                             int count);
+void      printReport       (const string& filename, RenderReport& report);
+void      printSummary      (vector<RenderReport>& reports, double walltime,
+                             int threads);
+double    elapsedSeconds    (chrono::steady_clock::time_point start);
+
+// global variables:
+Options   options;
+string    soundfontQ;         // used with -s option
+string    directoryQ;         // used with -o option
+int       threadsQ = 0;       // used with -j option
+int       shardsQ = 1;        // used with -n option
+int       blockQ = 8192;      // used with -b option
+int       rateQ = 44100;      // used with -r option
+int       polyphonyQ = 256;   // used with -p option
+double    tailQ = 2.0;        // used with -t option
+int       floatQ = 0;         // used with -f option
+
+
+///////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv) {
+   checkOptions(options, argc, argv);
+
+   vector<string> files;
+   for (int i=1; i<=options.getArgCount(); i++) {
+      files.push_back(options.getArg(i));
+   }
+
+   int threads = threadsQ;
+   if (threads <= 0) {
+      threads = (int)thread::hardware_concurrency();
+   }
+   if (threads > (int)files.size()) {
+      threads = (int)files.size();
+   }
+   if (threads < 1) {
+      threads = 1;
+   }
+
+   // Workers take the next file when they finish one, so long songs
+   // do not hold up the rest of the batch.
+   vector<RenderReport> reports(files.size());
+   atomic<int> next(0);
+   chrono::steady_clock::time_point start = chrono::steady_clock::now();
+   vector<thread> workers;
+   for (int i=1; i<threads; i++) {
+      workers.push_back(thread(renderWorker, ref(files), ref(reports),
+            ref(next)));
+   }
+   renderWorker(files, reports, next);
+   for (int i=0; i<(int)workers.size(); i++) {
+      workers[i].join();
+   }
+   double walltime = elapsedSeconds(start);
+
+   cout << "#seconds\trender-s\trealtime\tfile" << endl;
+   for (int i=0; i<(int)files.size(); i++) {
+      printReport(files[i], reports[i]);
+   }
+   printSummary(reports, walltime, threads);
+
+   for (int i=0; i<(int)reports.size(); i++) {
+      if (!reports[i].status) {
+         return 1;
+      }
+   }
+   return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////
+//
+// renderWorker -- set up a synthesizer and render files until none are
+//    left.  The synthesizer is reset between files, so the SoundFont is
+//    loaded only once per thread.
+//
+
+void renderWorker(vector<string>& files, vector<RenderReport>& reports,
+      atomic<int>& next) {
+   Synthesizer synth;
+   if (!synth.init(rateQ, polyphonyQ, false, shardsQ)) {
+      return;
+   }
+   if (!synth.load(soundfontQ.c_str())) {
+      return;
+   }
+
+   int index;
+   while ((index = next++) < (int)files.size()) {
+      synth.reset();
+      renderFile(synth, files[index], reports[index]);
+   }
+}
+
+
+
+//////////////////////////////
+//
+// renderFile -- play one MIDI file through the synthesizer and write the
+//    audio to a WAV file, followed by a tail of silence for the release
+//    and reverb of the last notes.  The header is written first with a
+//    zero length and filled in at the end.
+//
+
+void renderFile(Synthesizer& synth, const string& filename,
+      RenderReport& report) {
+   MidiFile midifile;
+   if (!midifile.readMapped(filename)) {
+      cerr << "Cannot read " << filename << endl;
+      return;
+   }
+   // Sequencer::load() joins the tracks and does the time analysis:
+   Sequencer sequencer;
+   if (!sequencer.load(midifile, rateQ)) {
+      cerr << "No notes in " << filename << endl;
+      return;
+   }
+
+   report.output = getOutputName(filename);
+   ofstream output(report.output.c_str(), ios::binary | ios::out);
+   if (!output.is_open()) {
+      cerr << "Cannot write " << report.output << endl;
+      return;
+   }
+   writeWaveHeader(output, 0);
+
+   vector<float> buffer(2 * blockQ);
+   vector<char> bytes;
+   long long tail = (long long)(tailQ * rateQ);
+   unsigned long long frames = 0;
+   int rendered = 1;
+
+   chrono::steady_clock::time_point start = chrono::steady_clock::now();
+   synth.setSequencer(&sequencer);
+   sequencer.play();
+   while (!sequencer.isFinished() || (tail > 0)) {
+      int count = blockQ;
+      if (sequencer.isFinished()) {
+         if (tail < count) {
+            count = (int)tail;
+         }
+         tail -= count;
+      }
+      if (!synth.synthesize(buffer.data(), count)) {
+         cerr << "Cannot render " << filename << endl;
+         rendered = 0;
+         break;
+      }
+      writeSamples(output, buffer.data(), 2 * count, bytes);
+      frames += count;
+   }
+   synth.setSequencer(NULL);
+
+   output.seekp(0);
+   writeWaveHeader(output, frames);
+   output.close();
+   report.rendertime = elapsedSeconds(start);
+   report.duration = (double)frames / rateQ;
+   report.status = rendered && !output.fail();
+   if (rendered && !report.status) {
+      cerr << "Error writing " << report.output << endl;
+   }
+}
+
+
+
+//////////////////////////////
+//
+// getOutputName -- the name of the MIDI file in the output directory,
+//    with a .wav extension instead of its own.
+//
+
+string getOutputName(const string& filename) {
+   string name = filename;
+   size_t slash = name.find_last_of("/\\");
+   if (slash != string::npos) {
+      name = name.substr(slash + 1);
+   }
+   size_t dot = name.rfind('.');
+   if (dot != string::npos) {
+      name = name.substr(0, dot);
+   }
+   return directoryQ + "/" + name + ".wav";
+}
+
+
+
+//////////////////////////////
+//
+// writeWaveHeader -- write a RIFF header for stereo audio with the given
+//    number of frames, as 16-bit integers or 32-bit floats (-f).
+//
+
+void writeWaveHeader(ostream& output, unsigned long long frames) {
+   int bytesize = floatQ ? 4 : 2;
+   unsigned long datasize = (unsigned long)(frames * 2 * bytesize);
+
+   vector<char> header;
+   appendLittleEndian(header, 0x46464952, 4);   // "RIFF"
+   appendLittleEndian(header, 36 + datasize, 4);
+   appendLittleEndian(header, 0x45564157, 4);   // "WAVE"
+   appendLittleEndian(header, 0x20746d66, 4);   // "fmt "
+   appendLittleEndian(header, 16, 4);
+   appendLittleEndian(header, floatQ ? 3 : 1, 2);
+   appendLittleEndian(header, 2, 2);
+   appendLittleEndian(header, rateQ, 4);
+   appendLittleEndian(header, rateQ * 2 * bytesize, 4);
+   appendLittleEndian(header, 2 * bytesize, 2);
+   appendLittleEndian(header, 8 * bytesize, 2);
+   appendLittleEndian(header, 0x61746164, 4);   // "data"
+   appendLittleEndian(header, datasize, 4);
+   output.write(header.data(), header.size());
+}
+
+
+
+//////////////////////////////
+//
+// writeSamples -- write interleaved samples in the format of the header.
+//    Integer samples are clipped to the range of 16 bits.
+//
+
+void writeSamples(ostream& output, const float* samples, int count,
+      vector<char>& bytes) {
+   if (floatQ) {
+      output.write((const char*)samples, count * sizeof(float));
+      return;
+   }
+   bytes.resize(2 * count);
+   for (int i=0; i<count; i++) {
+      float sample = samples[i];
+      if (sample > 1.0f) {
+         sample = 1.0f;
+      } else if (sample < -1.0f) {
+         sample = -1.0f;
+      }
+      int value = (int)lrintf(sample * 32767.0f);
+      bytes[2 * i]     = (char)(value & 0xff);
+      bytes[2 * i + 1] = (char)((value >> 8) & 0xff);
+   }
+   output.write(bytes.data(), bytes.size());
+}
+
+
+
+//////////////////////////////
+//
+// appendLittleEndian -- add the lowest count bytes of a value, least
+//    significant byte first.
+//
+
+void appendLittleEndian(vector<char>& data, unsigned long value, int count) {
+   for (int i=0; i<count; i++) {
+      data.push_back((char)((value >> (8 * i)) & 0xff));
+   }
+}
+
+
+
+//////////////////////////////
+//
+// printReport -- print the render speed for one file.
+//
+
+void printReport(const string& filename, RenderReport& report) {
+   if (!report.status) {
+      cout << "error\t\t\t" << filename << endl;
+      return;
+   }
+   cout << fixed << setprecision(2) << report.duration
+        << "\t" << setprecision(3) << report.rendertime
+        << "\t" << setprecision(1);
+   if (report.rendertime > 0.0) {
+      cout << report.duration / report.rendertime << "x";
+   } else {
+      cout << "-";
+   }
+   cout << "\t" << filename << endl;
+}
+
+
+
+//////////////////////////////
+//
+// printSummary -- print totals for the batch.  The speed per thread adds
+//    up the render times of all files, while the overall speed is measured
+//    against the wall-clock time of the batch.
+//
+
+void printSummary(vector<RenderReport>& reports, double walltime,
+      int threads) {
+   int failures = 0;
+   double duration = 0.0;
+   double rendertime = 0.0;
+   for (int i=0; i<(int)reports.size(); i++) {
+      if (!reports[i].status) {
+         failures++;
+         continue;
+      }
+      duration   += reports[i].duration;
+      rendertime += reports[i].rendertime;
+   }
+
+   cout << "# files:       " << reports.size() << " (" << failures
+        << " failed)" << endl;
+   cout << "# audio:       " << fixed << setprecision(1) << duration
+        << " s" << endl;
+   cout << "# render time: " << setprecision(3) << rendertime << " s";
+   if (rendertime > 0.0) {
+      cout << " (" << setprecision(1) << duration / rendertime
+           << "x realtime per thread)";
+   }
+   cout << endl;
+   cout << "# wall time:   " << setprecision(3) << walltime << " s";
+   if (walltime > 0.0) {
+      cout << " (" << setprecision(1) << duration / walltime
+           << "x realtime on " << threads
+           << (threads == 1 ? " thread)" : " threads)");
+   }
+   cout << endl;
+}
+
+
+
+//////////////////////////////
+//
+// elapsedSeconds -- seconds since the given time.
+//
+
+double elapsedSeconds(chrono::steady_clock::time_point start) {
+   chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+   return elapsed.count();
+}
+
+
+
+//////////////////////////////
+//
+// checkOptions -- process the command-line options.
+//
+
+void checkOptions(Options& opts, int argc, char** argv) {
+   opts.define("s|soundfont=s:data/primary.sf2", "SoundFont to render with");
+   opts.define("o|output=s:.", "directory for the WAV files");
+   opts.define("j|threads=i:0", "worker threads (0 for all cores)");
+   opts.define("n|shards=i:1", "synth instances per song, each on a thread");
+   opts.define("b|block=i:8192", "frames rendered per synthesize() call");
+   opts.define("r|rate=i:44100", "sample rate");
+   opts.define("p|polyphony=i:256", "maximum number of voices");
+   opts.define("t|tail=d:2.0", "seconds rendered after the last event");
+   opts.define("f|float=b", "write 32-bit float samples instead of 16-bit");
+   opts.process(argc, argv);
+
+   soundfontQ = opts.getString("soundfont");
+   directoryQ = opts.getString("output");
+   threadsQ = opts.getInteger("threads");
+   shardsQ = opts.getInteger("shards");
+   blockQ = opts.getInteger("block");
+   if (blockQ < 64) {
+      blockQ = 64;
+   }
+   rateQ = opts.getInteger("rate");
+   if ((rateQ < 8000) || (rateQ > 192000)) {
+      rateQ = 44100;
+   }
+   polyphonyQ = opts.getInteger("polyphony");
+   tailQ = opts.getDouble("tail");
+   if (tailQ < 0.0) {
+      tailQ = 0.0;
+   }
+   floatQ = opts.getBoolean("float");
+
+   if (opts.getArgCount() < 1) {
+      cerr << "Usage: " << opts.getCommand()
+           << " [-s soundfont] [-o directory] [-j threads] [-n shards]"
+           << " [-b block] [-r rate] [-p polyphony] [-t tail] [-f]"
+           << " file.mid [file.mid ...]" << endl;
+      exit(1);
+   }
+}
+
+
+
@@ -0,0 +1,443 @@
+//
+// Filename:      tools/vlqbench.cpp
+// Syntax:        C++11
+// vim:           ts=3 expandtab
+//
+// Description:   Microbenchmark for the variable-length value decoders
+//                of the MidiFile library.  A buffer of random delta
+//                times (mostly one and two bytes long, as in typical
+//                MIDI files) is decoded with a byte-at-a-time loop over
+//                an istream, with the byte-at-a-time span loop which
+//                MidiFile::readVLValue() uses, and with two experimental
+//                decoders kept here for comparison: a word-at-a-time
+//                decoder and a batch decoder using SSE2 where available.
+//                Neither beats the span loop on typical delta times, so
+//                the library does not use them.  All methods must
+//                produce the same values.
+//
+// Usage:         vlqbench [-n count] [-r repeat] [-s seed]
+//
+
+#include "MidiFile.h"
+#include "Options.h"
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <random>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+   #include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+   #include <intrin.h>
+#endif
+
+using namespace std;
+
+// function declarations:
+void      checkOptions      (Options& opts, int argc, char** argv);
+void      makeDeltas        (vector<uchar>& data, int count, int seed);
+int       scalarVLValue     (const uchar*& ptr, const uchar* end,
+                             ulong& value);
+int       wordVLValue       (const uchar* ptr, const uchar* end,
+                             ulong& value);
+int       batchVLValues     (const uchar*& ptr, const uchar* end,
+                             ulong* values, int count);
+double    elapsedSeconds    (chrono::steady_clock::time_point start);
+void      printResult       (const string& label, double seconds,
+                             int count, size_t bytes);
+
+// global variables:
+Options   options;
+int       countQ = 1000000;   // used with -n option
+int       repeatQ = 20;       // used with -r option
+int       seedQ = 1;          // used with -s option
+
+
+//
+// Word-at-a-time helpers for the experimental decoders:
+//
+
+static inline unsigned long long loadLittleEndian8Bytes(const uchar* ptr) {
+   unsigned long long word;
+   memcpy(&word, ptr, 8);
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+   word = __builtin_bswap64(word);
+#endif
+   return word;
+}
+
+
+static inline unsigned long long byteSwap8Bytes(unsigned long long word) {
+#if defined(__GNUC__) || defined(__clang__)
+   return __builtin_bswap64(word);
+#elif defined(_MSC_VER)
+   return _byteswap_uint64(word);
+#else
+   word = ((word & 0x00000000ffffffffULL) << 32) | (word >> 32);
+   word = ((word & 0x0000ffff0000ffffULL) << 16) |
+          ((word >> 16) & 0x0000ffff0000ffffULL);
+   word = ((word & 0x00ff00ff00ff00ffULL) << 8) |
+          ((word >> 8) & 0x00ff00ff00ff00ffULL);
+   return word;
+#endif
+}
+
+
+static inline int countTrailingZeros(unsigned long long word) {
+   // word must not be zero
+#if defined(__GNUC__) || defined(__clang__)
+   return __builtin_ctzll(word);
+#elif defined(_MSC_VER) && defined(_M_X64)
+   unsigned long index;
+   _BitScanForward64(&index, word);
+   return (int)index;
+#else
+   int count = 0;
+   while ((word & 1) == 0) {
+      word >>= 1;
+      count++;
+   }
+   return count;
+#endif
+}
+
+
+///////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv) {
+   checkOptions(options, argc, argv);
+
+   vector<uchar> data;
+   makeDeltas(data, countQ, seedQ);
+   const uchar* begin = data.data();
+   const uchar* end = begin + data.size();
+   vector<ulong> values(countQ);
+   unsigned long long sums[4] = {0, 0, 0, 0};
+   double times[4] = {0.0, 0.0, 0.0, 0.0};
+
+   string text((const char*)begin, data.size());
+   for (int r=0; r<repeatQ; r++) {
+      // byte-at-a-time istream loop:
+      istringstream input(text);
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      unsigned long long sum = 0;
+      for (int i=0; i<countQ; i++) {
+         ulong value = 0;
+         int byte;
+         do {
+            byte = input.get();
+            value = (value << 7) | (byte & 0x7f);
+         } while (byte & 0x80);
+         sum += value;
+      }
+      times[0] += elapsedSeconds(start);
+      sums[0] = sum;
+
+      // byte-at-a-time span loop:
+      start = chrono::steady_clock::now();
+      sum = 0;
+      const uchar* ptr = begin;
+      ulong value;
+      while (scalarVLValue(ptr, end, value)) {
+         sum += value;
+      }
+      times[1] += elapsedSeconds(start);
+      sums[1] = sum;
+
+      // word-at-a-time single values:
+      start = chrono::steady_clock::now();
+      sum = 0;
+      ptr = begin;
+      int length;
+      while ((length = wordVLValue(ptr, end, value)) > 0) {
+         ptr += length;
+         sum += value;
+      }
+      times[2] += elapsedSeconds(start);
+      sums[2] = sum;
+
+      // batch decoding:
+      start = chrono::steady_clock::now();
+      sum = 0;
+      ptr = begin;
+      int count = batchVLValues(ptr, end, values.data(), countQ);
+      for (int i=0; i<count; i++) {
+         sum += values[i];
+      }
+      times[3] += elapsedSeconds(start);
+      sums[3] = sum;
+   }
+
+   cout << countQ << " values, " << data.size() << " bytes" << endl;
+   printResult("istream loop", times[0] / repeatQ, countQ, data.size());
+   printResult("span loop", times[1] / repeatQ, countQ, data.size());
+   printResult("wordVLValue", times[2] / repeatQ, countQ, data.size());
+   printResult("batchVLValues", times[3] / repeatQ, countQ, data.size());
+   if (times[3] > 0.0) {
+      cout << "\tspeedup: " << fixed << setprecision(2)
+           << times[1] / times[2] << "x single, "
+           << times[1] / times[3] << "x batch (over span loop)" << endl;
+   }
+
+   for (int i=1; i<4; i++) {
+      if (sums[i] != sums[0]) {
+         cerr << "Error: decoders disagree" << endl;
+         return 1;
+      }
+   }
+   return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////
+//
+// makeDeltas -- fill the buffer with encoded delta times.  Most are
+//    zero or short (chords and note runs), with occasional long rests
+//    and a few values needing the full four bytes.
+//
+
+void makeDeltas(vector<uchar>& data, int count, int seed) {
+   mt19937 random(seed);
+   data.clear();
+   data.reserve(count * 2);
+   for (int i=0; i<count; i++) {
+      int choice = random() % 100;
+      ulong value;
+      if (choice < 40) {
+         value = 0;
+      } else if (choice < 75) {
+         value = random() % 0x80;
+      } else if (choice < 97) {
+         value = random() % 0x4000;
+      } else if (choice < 99) {
+         value = random() % 0x200000;
+      } else {
+         value = random() % 0x10000000;
+      }
+      uchar bytes[5];
+      int length = 0;
+      do {
+         bytes[length++] = value & 0x7f;
+         value >>= 7;
+      } while (value);
+      for (int j=length-1; j>0; j--) {
+         data.push_back(bytes[j] | 0x80);
+      }
+      data.push_back(bytes[0]);
+   }
+}
+
+
+
+//////////////////////////////
+//
+// scalarVLValue -- the byte-at-a-time decoder used by
+//    MidiFile::readVLValue() on byte spans, without its error messages.
+//
+
+int scalarVLValue(const uchar*& ptr, const uchar* end, ulong& value) {
+   value = 0;
+   for (int i=0; i<5; i++) {
+      if (ptr >= end) {
+         return 0;
+      }
+      uchar byte = *ptr++;
+      value = (value << 7) | (byte & 0x7f);
+      if (byte < 0x80) {
+         return 1;
+      }
+   }
+   return 0;
+}
+
+
+
+//////////////////////////////
+//
+// wordVLValue -- Decode one variable-length value from a
+//   byte span without advancing through it one byte at a time.  When at
+//   least eight bytes are available, they are loaded as one word and the
+//   end of the value is found from the lowest byte with a clear
+//   continuation bit; the 7-bit groups are then packed together with
+//   shifts and masks.  Returns the number of bytes in the value (1 to 5),
+//   or 0 if the span ends inside the value or it is longer than 5 bytes.
+//
+
+int wordVLValue(const uchar* ptr, const uchar* end, ulong& value) {
+   // most delta times are zero or short:
+   if ((ptr < end) && (ptr[0] < 0x80)) {
+      value = ptr[0];
+      return 1;
+   }
+   if (end - ptr >= 8) {
+      unsigned long long word = loadLittleEndian8Bytes(ptr);
+      unsigned long long stops = ~word & 0x8080808080808080ULL;
+      if (stops == 0) {
+         return 0;
+      }
+      int length = (countTrailingZeros(stops) >> 3) + 1;
+      if (length > 5) {
+         return 0;
+      }
+      // first byte of the value in the highest used byte:
+      unsigned long long bytes = (byteSwap8Bytes(word) >> (64 - 8 * length))
+            & 0x7f7f7f7f7fULL;
+      value = (ulong)( (bytes & 0x7fULL)
+                    | ((bytes >> 1) & 0x3f80ULL)
+                    | ((bytes >> 2) & 0x1fc000ULL)
+                    | ((bytes >> 3) & 0xfe00000ULL)
+                    | ((bytes >> 4) & 0x7f0000000ULL));
+      return length;
+   }
+
+   // near the end of the data:
+   value = 0;
+   for (int i=0; (i<5) && (ptr+i<end); i++) {
+      value = (value << 7) | (ptr[i] & 0x7f);
+      if (ptr[i] < 0x80) {
+         return i + 1;
+      }
+   }
+   return 0;
+}
+
+
+
+//////////////////////////////
+//
+// batchVLValues -- Decode up to count consecutive
+//   variable-length values from a byte span into values[], advancing ptr
+//   past them.  With SSE2 the continuation bits of sixteen bytes at a
+//   time are collected into a mask, and the one- and two-byte values
+//   which make up nearly all delta times are read from a table of byte
+//   pairs built for the whole block, so the only per-value work is
+//   finding the next clear bit in the mask.  Returns the number of
+//   values decoded; fewer than count means that the span ended or a
+//   malformed value was found at ptr.
+//
+
+int batchVLValues(const uchar*& ptr, const uchar* end, ulong* values,
+      int count) {
+   int decoded = 0;
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+   static const ulong lengthmask[3] = {0, 0x7f, 0x3fff};
+   const __m128i low7 = _mm_set1_epi8(0x7f);
+   const __m128i lowbyte = _mm_set1_epi16(0x00ff);
+   const __m128i highbits = _mm_set1_epi16(0x3f80);
+   unsigned short pairs[16];
+
+   while ((decoded < count) && (end - ptr >= 24)) {
+      __m128i block = _mm_loadu_si128((const __m128i*)ptr);
+      unsigned int stops = ~(unsigned int)_mm_movemask_epi8(block) & 0xffff;
+      if (stops == 0) {
+         break;
+      }
+
+      // pairs[i] = 7-bit groups of bytes i-1 and i as one 14-bit value:
+      __m128i groups = _mm_and_si128(block, low7);
+      __m128i previous = _mm_slli_si128(groups, 1);
+      __m128i lower = _mm_unpacklo_epi8(groups, previous);
+      __m128i upper = _mm_unpackhi_epi8(groups, previous);
+      lower = _mm_or_si128(_mm_and_si128(lower, lowbyte),
+            _mm_and_si128(_mm_srli_epi16(lower, 1), highbits));
+      upper = _mm_or_si128(_mm_and_si128(upper, lowbyte),
+            _mm_and_si128(_mm_srli_epi16(upper, 1), highbits));
+      _mm_storeu_si128((__m128i*)pairs, lower);
+      _mm_storeu_si128((__m128i*)(pairs + 8), upper);
+
+      int start = 0;
+      while (stops && (decoded < count)) {
+         int stop = countTrailingZeros(stops);
+         stops &= stops - 1;
+         int length = stop - start + 1;
+         if (length <= 2) {
+            values[decoded++] = pairs[stop] & lengthmask[length];
+         } else if (wordVLValue(ptr + start, end, values[decoded])) {
+            decoded++;
+         } else {
+            // longer than 5 bytes
+            ptr += start;
+            return decoded;
+         }
+         start = stop + 1;
+      }
+      ptr += start;
+   }
+#endif
+
+   while (decoded < count) {
+      int length = wordVLValue(ptr, end, values[decoded]);
+      if (length == 0) {
+         break;
+      }
+      ptr += length;
+      decoded++;
+   }
+   return decoded;
+}
+
+
+
+//////////////////////////////
+//
+// elapsedSeconds -- time since the given starting point.
+//
+
+double elapsedSeconds(chrono::steady_clock::time_point start) {
+   chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+   return elapsed.count();
+}
+
+
+
+//////////////////////////////
+//
+// printResult -- print timing for one method.
+//
+
+void printResult(const string& label, double seconds, int count,
+      size_t bytes) {
+   cout << "\t" << left << setw(20) << label << right << fixed
+        << setprecision(3) << setw(10) << seconds * 1000.0 << " ms";
+   if (count > 0) {
+      cout << setprecision(2) << setw(10) << seconds * 1e9 / count
+           << " ns/value";
+   }
+   if ((seconds > 0.0) && (bytes > 0)) {
+      cout << setprecision(1) << setw(10) << bytes / seconds / 1e6
+           << " MB/s";
+   }
+   cout << endl;
+}
+
+
+
+//////////////////////////////
+//
+// checkOptions -- process the command-line options.
+//
+
+void checkOptions(Options& opts, int argc, char** argv) {
+   opts.define("n|count=i:1000000", "number of values to decode");
+   opts.define("r|repeat=i:20", "number of times to decode the buffer");
+   opts.define("s|seed=i:1", "random seed for the generated values");
+   opts.process(argc, argv);
+
+   countQ = opts.getInteger("count");
+   if (countQ < 1) {
+      countQ = 1;
+   }
+   repeatQ = opts.getInteger("repeat");
+   if (repeatQ < 1) {
+      repeatQ = 1;
+   }
+   seedQ = opts.getInteger("seed");
+}